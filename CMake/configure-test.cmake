@@ -1,5 +1,4 @@
-function(configure_test TARGET)
-  target_link_libraries(${TARGET} PRIVATE GTest::gtest_main)
+function(link_host_runtime TARGET)
   if (CMAKE_CXX_COMPILER_ID STREQUAL "Clang" OR CMAKE_CXX_COMPILER_ID STREQUAL "AppleClang")
     if (CMAKE_SYSTEM_NAME STREQUAL "Linux")
       target_link_libraries(${TARGET} PRIVATE stdc++ m)
@@ -13,6 +12,11 @@ function(configure_test TARGET)
   else ()
     message(FATAL_ERROR "Unsupported compiler: ${CMAKE_CXX_COMPILER_ID}")
   endif ()
+endfunction()
+
+function(configure_test TARGET)
+  target_link_libraries(${TARGET} PRIVATE GTest::gtest_main)
+  link_host_runtime(${TARGET})
   target_link_options(${TARGET} PRIVATE ${COVERAGE_LINKER_OPTIONS})
   target_compile_options(${TARGET} PRIVATE ${COVERAGE_CXX_FLAGS})
   set_target_properties(${TARGET} PROPERTIES IS_TEST_CASE ON)
@@ -24,3 +28,13 @@ function(configure_test TARGET)
   set_target_properties(${TARGET} PROPERTIES ADDITIONAL_CLEAN_FILES "coverage/${TARGET};default.profraw" COVERAGE_FILES "${CMAKE_CURRENT_BINARY_DIR}/coverage/${TARGET}/*.profraw")
   gtest_discover_tests(${TARGET} PROPERTIES ENVIRONMENT "LLVM_PROFILE_FILE=${CMAKE_CURRENT_BINARY_DIR}/coverage/${TARGET}/%p.profraw")
 endfunction()
+
+# benchmarks run as a single ctest each and leave their results in <target>.json for comparing builds
+function(configure_benchmark TARGET)
+  target_link_libraries(${TARGET} PRIVATE benchmark::benchmark_main)
+  link_host_runtime(${TARGET})
+  add_test(NAME ${TARGET}
+      COMMAND ${TARGET} --benchmark_min_time=0.05s --benchmark_out=${CMAKE_CURRENT_BINARY_DIR}/${TARGET}.json
+      --benchmark_out_format=json)
+  set_tests_properties(${TARGET} PROPERTIES LABELS benchmark)
+endfunction()
@@ -0,0 +1,105 @@
+#include "Interrupts.h"
+#include <memutil.h>
+#include "memory/paging.h"
+#include "utils/panic.h"
+
+// 16 entries of 0x80 bytes: sync, irq, fiq and serror for the current EL with SP_EL0, the current EL with SP_ELx,
+// a lower EL in aarch64 and a lower EL in aarch32. Each entry saves x0/x1 and passes its index to the common path.
+asm(R"(
+  .text
+  .balign 0x800
+  .global exceptionVectors
+exceptionVectors:
+  .irp index, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    .balign 0x80
+    sub sp, sp, #272
+    stp x0, x1, [sp, #0]
+    mov x0, #\index
+    b exceptionCommon
+  .endr
+
+exceptionCommon:
+  stp x2, x3, [sp, #16]
+  stp x4, x5, [sp, #32]
+  stp x6, x7, [sp, #48]
+  stp x8, x9, [sp, #64]
+  stp x10, x11, [sp, #80]
+  stp x12, x13, [sp, #96]
+  stp x14, x15, [sp, #112]
+  stp x16, x17, [sp, #128]
+  stp x18, x19, [sp, #144]
+  stp x20, x21, [sp, #160]
+  stp x22, x23, [sp, #176]
+  stp x24, x25, [sp, #192]
+  stp x26, x27, [sp, #208]
+  stp x28, x29, [sp, #224]
+  mrs x1, elr_el1
+  stp x30, x1, [sp, #240]
+  mrs x1, spsr_el1
+  str x1, [sp, #256]
+  mov x1, sp
+  bl exceptionDispatch
+  ldr x1, [sp, #256]
+  msr spsr_el1, x1
+  ldp x30, x1, [sp, #240]
+  msr elr_el1, x1
+  ldp x28, x29, [sp, #224]
+  ldp x26, x27, [sp, #208]
+  ldp x24, x25, [sp, #192]
+  ldp x22, x23, [sp, #176]
+  ldp x20, x21, [sp, #160]
+  ldp x18, x19, [sp, #144]
+  ldp x16, x17, [sp, #128]
+  ldp x14, x15, [sp, #112]
+  ldp x12, x13, [sp, #96]
+  ldp x10, x11, [sp, #80]
+  ldp x8, x9, [sp, #64]
+  ldp x6, x7, [sp, #48]
+  ldp x4, x5, [sp, #32]
+  ldp x2, x3, [sp, #16]
+  ldp x0, x1, [sp, #0]
+  add sp, sp, #272
+  eret
+)");
+
+extern "C" char exceptionVectors[];
+
+using memory::toPtr;
+
+namespace {
+  constexpr uint64_t VECTOR_SYNC_SP0 = 0;
+  constexpr uint64_t VECTOR_SYNC_SPX = 4;
+  // the low two bits of the fault status code are the level the fault happened at
+  constexpr uint64_t FSC_TYPE_MASK = 0x3C;
+  constexpr uint64_t FSC_TRANSLATION = 0x04;
+  constexpr uint64_t FSC_PERMISSION = 0x0C;
+  // write not read, set for a data abort caused by a store
+  constexpr uint64_t ESR_WNR = 1 << 6;
+} // namespace
+
+extern "C" void exceptionDispatch(const uint64_t index, interrupts::aarch64::ExceptionFrame *frame) {
+  uint64_t esr;
+  uint64_t far;
+  asm volatile("mrs %0, esr_el1; mrs %1, far_el1" : "=r"(esr), "=r"(far));
+  if (index == VECTOR_SYNC_SP0 || index == VECTOR_SYNC_SPX) {
+    const auto ec = esr >> 26 & 0x3F;
+    if ((ec == interrupts::aarch64::Interrupts::EC_DATA_ABORT ||
+         ec == interrupts::aarch64::Interrupts::EC_INSTRUCTION_ABORT) &&
+        (esr & FSC_TYPE_MASK) == FSC_TRANSLATION && memory::paging.handleFault(far)) {
+      return;
+    }
+    if (ec == interrupts::aarch64::Interrupts::EC_DATA_ABORT && (esr & ESR_WNR) &&
+        (esr & FSC_TYPE_MASK) == FSC_PERMISSION && memory::Paging::activeSpace().handleWriteFault(far)) {
+      return;
+    }
+  }
+  kpanicf("exception %lu at %p esr %lx far %p", index, toPtr(frame->elr), esr, toPtr(far));
+}
+
+namespace interrupts {
+  Interrupts defaultInterrupts;
+
+  namespace aarch64 {
+    void Interrupts::init() { asm volatile("msr vbar_el1, %0; isb" : : "r"(exceptionVectors) : "memory"); }
+  } // namespace aarch64
+} // namespace interrupts
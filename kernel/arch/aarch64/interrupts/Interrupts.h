@@ -0,0 +1,31 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+#include <cstdint>
+
+namespace interrupts {
+  namespace aarch64 {
+    // register state saved by the vector entries, in the order it sits on the stack
+    struct ExceptionFrame {
+      uint64_t x[31];
+      uint64_t elr;
+      uint64_t spsr;
+      uint64_t padding;
+    };
+
+    class Interrupts {
+    public:
+      // exception classes from ESR_EL1
+      static constexpr uint64_t EC_INSTRUCTION_ABORT = 0x21;
+      static constexpr uint64_t EC_DATA_ABORT = 0x25;
+
+      // points VBAR_EL1 at the exception vectors, translation faults are forwarded to the paging code
+      void init();
+    };
+  } // namespace aarch64
+
+  using Interrupts = aarch64::Interrupts;
+
+  extern Interrupts defaultInterrupts;
+} // namespace interrupts
+
+#endif // INTERRUPTS_H
@@ -0,0 +1,106 @@
+#ifndef AARCH64_PAGETABLEARCH_H
+#define AARCH64_PAGETABLEARCH_H
+#include <cstdint>
+#include "memory/MemoryType.h"
+
+namespace memory {
+  namespace aarch64 {
+    // 4 KiB granule, 4 level VMSAv8-64 tables with ttbr0 for the lower and ttbr1 for the kernel half
+    struct PageTableArch {
+      static constexpr uint64_t PAGE_VALID = 1 << 0;
+      static constexpr uint64_t PAGE_TABLE = 1 << 1;
+      // AttrIndx, selects a MAIR_EL1 attribute
+      static constexpr uint64_t PAGE_ATTR_INDEX_SHIFT = 2;
+      // AP[2]
+      static constexpr uint64_t PAGE_READ_ONLY = 1 << 7;
+      static constexpr uint64_t PAGE_NOT_GLOBAL = 1 << 11;
+      // reserved for software: the page is shared read only until the next write copies it
+      static constexpr uint64_t PAGE_COW = 1ull << 55;
+      // reserved for software: the frame belongs to the address space and is released with it
+      static constexpr uint64_t PAGE_OWNED = 1ull << 56;
+      static constexpr uint64_t PAGE_ADDR_MASK = 0x000FFFFFFFFFF000ull;
+      static constexpr uint64_t PAGE_FLAGS_MASK = ~PAGE_ADDR_MASK;
+
+      static constexpr int ROOTS = 2;
+      static constexpr int LEVELS = 4;
+      // 4 KiB pages and 9 index bits per level, the root is level 1
+      static constexpr int PAGE_SHIFT = 12;
+      static constexpr int INDEX_BITS = 9;
+      // for a 48 bit kernel half, init takes the real start from T1SZ
+      static constexpr uint64_t KERNEL_HALF = 0xFFFF000000000000ull;
+      static constexpr uint64_t PRESENT = PAGE_VALID;
+      static constexpr uint64_t ADDRESS_MASK = PAGE_ADDR_MASK;
+      // the access flag is managed by software and nothing else is written back
+      static constexpr uint64_t HARDWARE_FLAGS = 0;
+      static constexpr uint64_t COW = PAGE_COW;
+      static constexpr uint64_t OWNED = PAGE_OWNED;
+      static constexpr uint64_t HHDM_FLAGS = 0x700;
+      static constexpr uint64_t MEMORY_TYPE_MASK = 7 << PAGE_ATTR_INDEX_SHIFT;
+      // one attribute per MemoryType: normal write back, normal non cacheable, Device-nGnRnE and normal write through
+      static constexpr uint64_t MAIR_LAYOUT = 0xFFull | 0x44ull << 8 | 0x00ull << 16 | 0xBBull << 24;
+      // tlbi vaae1is reaches every core and every ASID
+      static constexpr bool BROADCAST_INVALIDATION = true;
+
+      // names of the flags in page table dumps
+      struct FlagName {
+        uint64_t flag;
+        const char *name;
+      };
+      static constexpr FlagName FLAG_NAMES[] = {{PAGE_VALID, "V"}, {PAGE_TABLE, "T"}};
+
+      // the table bit marks a table above the last level and a page on it
+      static constexpr bool isTable(const uint64_t entry, const int level) {
+        return level < LEVELS && (entry & PAGE_TABLE);
+      }
+
+      static constexpr uint64_t makeTable(const uint64_t physical) { return physical | PAGE_VALID | PAGE_TABLE; }
+
+      static constexpr uint64_t makeLeaf(const uint64_t physical, const uint64_t flags, const int level) {
+        return (physical & PAGE_ADDR_MASK) | PAGE_VALID | flags | (level == LEVELS ? PAGE_TABLE : 0);
+      }
+
+      static constexpr uint64_t leafFlags(const uint64_t entry, const int) {
+        return entry & PAGE_FLAGS_MASK & ~(PAGE_VALID | PAGE_TABLE);
+      }
+
+      static constexpr uint64_t memoryTypeFlags(const MemoryType type) {
+        return static_cast<uint64_t>(type) << PAGE_ATTR_INDEX_SHIFT;
+      }
+
+      // the type closest to a MAIR attribute, by its outer cacheability
+      static constexpr MemoryType attributeMemoryType(const uint8_t attribute) {
+        const auto outer = attribute >> 4;
+        if (outer == 0) {
+          return MemoryType::UC;
+        }
+        if (outer == 4) {
+          return MemoryType::WC;
+        }
+        if (outer < 4 || (outer & 0xC) == 8) {
+          return MemoryType::WT;
+        }
+        return MemoryType::WB;
+      }
+
+      // moves flags written for the attributes in mair over to MAIR_LAYOUT
+      static constexpr uint64_t relayoutFlags(const uint64_t flags, const uint64_t mair) {
+        const auto index = (flags & MEMORY_TYPE_MASK) >> PAGE_ATTR_INDEX_SHIFT;
+        return (flags & ~MEMORY_TYPE_MASK) | memoryTypeFlags(attributeMemoryType(mair >> index * 8 & 0xFF));
+      }
+
+      static constexpr bool isWritable(const uint64_t value) { return !(value & PAGE_READ_ONLY); }
+
+      static constexpr uint64_t withWrite(const uint64_t value, const bool write) {
+        return write ? value & ~PAGE_READ_ONLY : value | PAGE_READ_ONLY;
+      }
+
+      // the lower half is tagged with the ASID of its address space
+      static constexpr uint64_t globalFlags(const uint64_t flags, const bool kernel) {
+        return kernel ? flags & ~PAGE_NOT_GLOBAL : flags | PAGE_NOT_GLOBAL;
+      }
+
+      static constexpr uint64_t canonical(const uint64_t address) { return address; }
+    };
+  } // namespace aarch64
+} // namespace memory
+#endif // AARCH64_PAGETABLEARCH_H
@@ -18,7 +18,7 @@ namespace serial {
 
   namespace aarch64 {
     void Serial::init(const uint64_t hhdmOffset) {
-      memory::paging.mapMemory(getBaseAddr(), getBaseAddr() + hhdmOffset, PAGE_SIZE, 1, 0x700);
+      memory::paging.mapMemory(getBaseAddr(), getBaseAddr() + hhdmOffset, PAGE_SIZE, 1, 0x700, memory::MemoryType::UC);
       base = addToPointer(base, hhdmOffset);
       if (const auto fr = *addToPointer(base, FR); fr != 0xFFFFFFFF && fr != 0x00000000) {
         kprint("Serial Port Found\n");
@@ -0,0 +1,113 @@
+#include "Interrupts.h"
+#include <memutil.h>
+#include "memory/paging.h"
+#include "utils/panic.h"
+
+// one 16 byte stub per exception vector, so stub n lives at interruptStubs + n * 16. Vectors without a cpu pushed
+// error code push a zero so every frame has the same layout.
+asm(R"(
+  .text
+  .balign 16
+  .global interruptStubs
+interruptStubs:
+  .irp vector, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
+    .balign 16
+    .if (\vector != 8) && (\vector != 10) && (\vector != 11) && (\vector != 12) && (\vector != 13) && (\vector != 14) && (\vector != 17) && (\vector != 21) && (\vector != 29) && (\vector != 30)
+      pushq $0
+    .endif
+    pushq $\vector
+    jmp interruptCommon
+  .endr
+
+interruptCommon:
+  pushq %rax
+  pushq %rbx
+  pushq %rcx
+  pushq %rdx
+  pushq %rsi
+  pushq %rdi
+  pushq %rbp
+  pushq %r8
+  pushq %r9
+  pushq %r10
+  pushq %r11
+  pushq %r12
+  pushq %r13
+  pushq %r14
+  pushq %r15
+  movq %rsp, %rdi
+  cld
+  call interruptDispatch
+  popq %r15
+  popq %r14
+  popq %r13
+  popq %r12
+  popq %r11
+  popq %r10
+  popq %r9
+  popq %r8
+  popq %rbp
+  popq %rdi
+  popq %rsi
+  popq %rdx
+  popq %rcx
+  popq %rbx
+  popq %rax
+  addq $16, %rsp
+  iretq
+)");
+
+extern "C" char interruptStubs[];
+
+using memory::toPtr;
+
+namespace {
+  constexpr uint64_t PAGE_FAULT_PRESENT = 1 << 0;
+  constexpr uint64_t PAGE_FAULT_WRITE = 1 << 1;
+  constexpr uint64_t PAGE_FAULT_USER = 1 << 2;
+} // namespace
+
+extern "C" void interruptDispatch(interrupts::x86_64::InterruptFrame *frame) {
+  if (frame->vector == interrupts::x86_64::Interrupts::VECTOR_PAGE_FAULT) {
+    uint64_t cr2;
+    asm volatile("mov %%cr2, %0" : "=r"(cr2));
+    if ((frame->errorCode & (PAGE_FAULT_PRESENT | PAGE_FAULT_USER)) == 0 && memory::paging.handleFault(cr2)) {
+      return;
+    }
+    const auto write = PAGE_FAULT_PRESENT | PAGE_FAULT_WRITE;
+    if ((frame->errorCode & write) == write && memory::Paging::activeSpace().handleWriteFault(cr2)) {
+      return;
+    }
+    kpanicf("page fault at %p accessing %p error %lx", toPtr(frame->rip), toPtr(cr2), frame->errorCode);
+  }
+  kpanicf("exception %lu at %p error %lx", frame->vector, toPtr(frame->rip), frame->errorCode);
+}
+
+namespace interrupts {
+  Interrupts defaultInterrupts;
+
+  namespace x86_64 {
+    void Interrupts::init() {
+      uint16_t cs;
+      asm volatile("mov %%cs, %0" : "=r"(cs));
+      for (uint8_t vector = 0; vector < EXCEPTION_COUNT; vector++) {
+        const auto stub = reinterpret_cast<uint64_t>(interruptStubs + vector * 16);
+        idt[vector] = {
+            .offsetLow = static_cast<uint16_t>(stub),
+            .selector = cs,
+            .ist = 0,
+            // present, ring 0, 64 bit interrupt gate
+            .typeAttributes = 0x8E,
+            .offsetMiddle = static_cast<uint16_t>(stub >> 16),
+            .offsetHigh = static_cast<uint32_t>(stub >> 32),
+            .reserved = 0,
+        };
+      }
+      const struct [[gnu::packed]] {
+        uint16_t limit;
+        uint64_t base;
+      } idtr = {sizeof(idt) - 1, reinterpret_cast<uint64_t>(idt)};
+      asm volatile("lidt %0" : : "m"(idtr) : "memory");
+    }
+  } // namespace x86_64
+} // namespace interrupts
@@ -0,0 +1,44 @@
+#ifndef INTERRUPTS_H
+#define INTERRUPTS_H
+#include <cstdint>
+
+namespace interrupts {
+  namespace x86_64 {
+    // register state saved by the entry stubs, in the order it sits on the stack
+    struct InterruptFrame {
+      uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+      uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+      uint64_t vector;
+      uint64_t errorCode;
+      uint64_t rip, cs, rflags, rsp, ss;
+    };
+
+    class Interrupts {
+    public:
+      static constexpr uint8_t VECTOR_PAGE_FAULT = 14;
+      static constexpr uint8_t EXCEPTION_COUNT = 32;
+
+      // installs handlers for the cpu exceptions, page faults are forwarded to the paging code
+      void init();
+
+    private:
+      struct [[gnu::packed]] Gate {
+        uint16_t offsetLow;
+        uint16_t selector;
+        uint8_t ist;
+        uint8_t typeAttributes;
+        uint16_t offsetMiddle;
+        uint32_t offsetHigh;
+        uint32_t reserved;
+      };
+
+      alignas(16) Gate idt[256] = {};
+    };
+  } // namespace x86_64
+
+  using Interrupts = x86_64::Interrupts;
+
+  extern Interrupts defaultInterrupts;
+} // namespace interrupts
+
+#endif // INTERRUPTS_H
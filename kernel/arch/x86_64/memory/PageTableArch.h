@@ -0,0 +1,116 @@
+#ifndef X86_64_PAGETABLEARCH_H
+#define X86_64_PAGETABLEARCH_H
+#include <cstdint>
+#include "memory/MemoryType.h"
+
+namespace memory {
+  namespace x86_64 {
+    // 4 level long mode tables, a single root covers both halves
+    struct PageTableArch {
+      // Page table entry flags
+      static constexpr uint64_t PAGE_PRESENT = 1 << 0;
+      static constexpr uint64_t PAGE_WRITE = 1 << 1;
+      static constexpr uint64_t PAGE_USER = 1 << 2;
+      static constexpr uint64_t PAGE_WRITE_THROUGH = 1 << 3;
+      static constexpr uint64_t PAGE_CACHE_DISABLE = 1 << 4;
+      static constexpr uint64_t PAGE_ACCESSED = 1 << 5;
+      static constexpr uint64_t PAGE_DIRTY = 1 << 6;
+      static constexpr uint64_t PAGE_SIZE_FLAG = 1 << 7;
+      static constexpr uint64_t PAGE_GLOBAL = 1 << 8;
+      // bit 12 of a large page and bit 7 of a 4 KiB page, flags always carry it in bit 12
+      static constexpr uint64_t PAGE_PAT = 1 << 12;
+      static constexpr uint64_t PAGE_PAT_4K = 1 << 7;
+      static constexpr uint64_t PAGE_NX = 1ULL << 63;
+      // ignored bits 52-58 are left to software, 9-11 are not used since callers still pass raw flags like 0x700
+      // the page is shared read only until the next write copies it
+      static constexpr uint64_t PAGE_COW = 1ull << 52;
+      // the frame belongs to the address space and is released with it
+      static constexpr uint64_t PAGE_OWNED = 1ull << 53;
+      static constexpr uint64_t PAGE_ADDR_MASK = 0x000FFFFFFFFFF000ull;
+      // bits 52-63 are reserved for future use + NX
+      static constexpr uint64_t PAGE_FLAGS_MASK = 0xFFF | 0xFFFull << 52;
+
+      static constexpr int ROOTS = 1;
+      static constexpr int LEVELS = 4;
+      // 4 KiB pages and 9 index bits per level, the root is level 1
+      static constexpr int PAGE_SHIFT = 12;
+      static constexpr int INDEX_BITS = 9;
+      static constexpr uint64_t KERNEL_HALF = 0xFFFF800000000000ull;
+      static constexpr uint64_t PRESENT = PAGE_PRESENT;
+      static constexpr uint64_t ADDRESS_MASK = PAGE_ADDR_MASK;
+      static constexpr uint64_t HARDWARE_FLAGS = PAGE_ACCESSED | PAGE_DIRTY;
+      static constexpr uint64_t COW = PAGE_COW;
+      static constexpr uint64_t OWNED = PAGE_OWNED;
+      static constexpr uint64_t HHDM_FLAGS = PAGE_WRITE | PAGE_NX;
+      static constexpr uint64_t MEMORY_TYPE_MASK = PAGE_PAT | PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH;
+      // the layout limine sets up: WB, WT, UC-, UC, WP, WC, UC-, UC
+      static constexpr uint64_t PAT_LAYOUT = 0x0007010500070406ull;
+      // invlpg only reaches the current PCID
+      static constexpr bool BROADCAST_INVALIDATION = false;
+
+      // names of the flags in page table dumps
+      struct FlagName {
+        uint64_t flag;
+        const char *name;
+      };
+      static constexpr FlagName FLAG_NAMES[] = {
+          {PAGE_PRESENT, "P"},       {PAGE_WRITE, "W"}, {PAGE_USER, "U"},     {PAGE_WRITE_THROUGH, "T"},
+          {PAGE_CACHE_DISABLE, "C"}, {PAGE_PAT, "A"},   {PAGE_SIZE_FLAG, "S"}, {PAGE_GLOBAL, "G"},
+          {PAGE_NX, "NX"},
+      };
+
+      // the root only holds tables, below it PS turns an entry into a leaf
+      static constexpr bool isTable(const uint64_t entry, const int level) {
+        return level == 1 || (level < LEVELS && !(entry & PAGE_SIZE_FLAG));
+      }
+
+      static constexpr uint64_t makeTable(const uint64_t physical) {
+        return physical | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+      }
+
+      static constexpr uint64_t makeLeaf(const uint64_t physical, const uint64_t flags, const int level) {
+        if (level < LEVELS) {
+          return (physical & PAGE_ADDR_MASK) | PAGE_PRESENT | flags | PAGE_SIZE_FLAG;
+        }
+        return (physical & PAGE_ADDR_MASK) | PAGE_PRESENT | (flags & ~PAGE_PAT) | (flags & PAGE_PAT ? PAGE_PAT_4K : 0);
+      }
+
+      static constexpr uint64_t leafFlags(const uint64_t entry, const int level) {
+        if (level < LEVELS) {
+          return (entry & PAGE_FLAGS_MASK & ~(PAGE_PRESENT | PAGE_SIZE_FLAG)) | (entry & PAGE_PAT);
+        }
+        return (entry & PAGE_FLAGS_MASK & ~(PAGE_PRESENT | PAGE_PAT_4K)) | (entry & PAGE_PAT_4K ? PAGE_PAT : 0);
+      }
+
+      // PAT, PCD and PWT select an entry of PAT_LAYOUT
+      static constexpr uint64_t memoryTypeFlags(const MemoryType type) {
+        switch (type) {
+          case MemoryType::WC:
+            return PAGE_PAT | PAGE_WRITE_THROUGH;
+          case MemoryType::UC:
+            return PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH;
+          case MemoryType::WT:
+            return PAGE_WRITE_THROUGH;
+          default:
+            return 0;
+        }
+      }
+
+      static constexpr bool isWritable(const uint64_t value) { return value & PAGE_WRITE; }
+
+      static constexpr uint64_t withWrite(const uint64_t value, const bool write) {
+        return write ? value | PAGE_WRITE : value & ~PAGE_WRITE;
+      }
+
+      static constexpr uint64_t globalFlags(const uint64_t flags, const bool kernel) {
+        return kernel ? flags | PAGE_GLOBAL : flags;
+      }
+
+      // addresses are sign extended from bit 47
+      static constexpr uint64_t canonical(const uint64_t address) {
+        return address & 1ull << 47 ? address | 0xFFFF000000000000 : address;
+      }
+    };
+  } // namespace x86_64
+} // namespace memory
+#endif // X86_64_PAGETABLEARCH_H
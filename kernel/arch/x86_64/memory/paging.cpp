@@ -1,9 +1,8 @@
 #include "paging.h"
-#include <cstring>
 #include <memutil.h>
 #include "framebuffer/VirtualConsole.h"
 #include "limine.h"
-#include "utils/bytes.h"
+#include "memory/EarlyArena.h"
 #include "utils/panic.h"
 
 namespace memory {
@@ -18,86 +17,8 @@ namespace memory {
 
   Paging paging;
 
-  constexpr size_t INITIAL_POOL_SIZE = 128;
-  char initialPool[INITIAL_POOL_SIZE][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
-  uint8_t initialPoolUsedCount = 0;
-
-  void *initialPoolGetPage(size_t);
-
-  void *(*GetPagePtr)(size_t count) = initialPoolGetPage;
-
-  void *initialPoolGetPage(const size_t count) {
-    const auto rt = reinterpret_cast<void *>(initialPool[initialPoolUsedCount]);
-    if (initialPoolUsedCount + count >= INITIAL_POOL_SIZE) {
-      kpanic("out of initial pool");
-    }
-    initialPoolUsedCount += count;
-    return rt;
-  }
-
-  uint64_t Paging::pageIndexesToVirtual(const uint64_t l[], const size_t count) {
-    uint64_t address = 0;
-    if (count > 0) {
-      address |= l[0] << 39;
-      if (count > 1) {
-        address |= l[1] << 30;
-        if (count > 2) {
-          address |= l[2] << 21;
-          if (count > 3) {
-            address |= l[3] << 12;
-          }
-        }
-      }
-    }
-    // Sign-extend the address if the 48th bit is set
-    if (address & (1ULL << 47)) {
-      address |= 0xFFFF000000000000;
-    }
-    return address;
-  }
-
-  Paging::virtualToPageIndexes_t Paging::virtualToPageIndexes(const uint64_t virtualAddress) {
-    return {(virtualAddress >> 39) & 0x1FF, (virtualAddress >> 30) & 0x1FF, (virtualAddress >> 21) & 0x1FF,
-            (virtualAddress >> 12) & 0x1FF};
-  }
-
-  char *Paging::tableFlagsToString(const uint64_t flags) {
-    static char buf[32];
-    size_t n = 0;
-    if (flags & PAGE_PRESENT) {
-      buf[n++] = 'P';
-    }
-    if (flags & PAGE_WRITE) {
-      buf[n++] = 'W';
-    }
-    if (flags & PAGE_USER) {
-      buf[n++] = 'U';
-    }
-    if (flags & PAGE_WRITE_THROUGH) {
-      buf[n++] = 'T';
-    }
-    if (flags & PAGE_CACHE_DISABLE) {
-      buf[n++] = 'C';
-    }
-    if (flags & PAGE_SIZE_FLAG) {
-      buf[n++] = 'S';
-    }
-    if (flags & PAGE_GLOBAL) {
-      buf[n++] = 'G';
-    }
-    if (flags & PAGE_NX) {
-      buf[n++] = 'N';
-      buf[n++] = 'X';
-    }
-    buf[n] = 0;
-    return buf;
-  };
-
   void Paging::init(const size_t count, limine_memmap_entry **mappings, const uint64_t hhdmVirtualOffset,
                     const uint64_t kernelVirtualOffset) {
-    if (hhdmVirtualOffset % PAGE_SIZE != 0) {
-      kpanic("virtual offset must be page aligned");
-    }
     if (paging_request.response == nullptr) {
       kpanic("paging request not set");
     }
@@ -106,158 +27,78 @@ namespace memory {
     }
     uint64_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
-    kprintf("current cr3: %p/%p initial pool %p\n", toPtr(cr3), addToPointer(toPtr(cr3), hhdmVirtualOffset),
-            toPtr(initialPool));
-
-    root = static_cast<uint64_t *>(GetPagePtr(1));
-    pageTableOffset = kernelVirtualOffset;
-    memset(root, 0, PAGE_SIZE);
-
-    struct callbackData {
-      size_t mapCount;
-      limine_memmap_entry **mappings;
-      Paging *paging;
-      uint64_t hhdmVirtualOffset;
-    };
-    callbackData data = {count, mappings, this, hhdmVirtualOffset};
-    pageTableToRangesCallback<callbackData> callback = [](PageTableRangeData *page_table_range_data,
-                                                          callbackData *data) {
-      static auto isTypeToMap = [](const uint64_t type) {
-        return type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE || type == LIMINE_MEMMAP_KERNEL_AND_MODULES ||
-               type == LIMINE_MEMMAP_FRAMEBUFFER;
-      };
-      static auto rangesOverlap = [](PageTableRangeData *page_table_range_data, limine_memmap_entry *entry) {
-        return (page_table_range_data->physicalStart <= entry->base + entry->length &&
-                page_table_range_data->physicalEnd >= entry->base) ||
-               (page_table_range_data->physicalStart <= entry->base &&
-                page_table_range_data->physicalEnd >= entry->base) ||
-               (page_table_range_data->physicalStart <= entry->base + entry->length &&
-                page_table_range_data->physicalEnd >= entry->base + entry->length);
-      };
-      bool mapped = false;
-      for (size_t i = 0; i < data->mapCount; i++) {
-        if (rangesOverlap(page_table_range_data, data->mappings[i])) {
-          if (isTypeToMap(data->mappings[i]->type)) {
-            char buff[32];
-            kprintf("block %p-%p/%p-%p %lu(%s) %s %lu\n", toPtr(page_table_range_data->virtualStart),
-                    toPtr(page_table_range_data->virtualEnd), toPtr(page_table_range_data->physicalStart),
-                    toPtr(page_table_range_data->physicalEnd), page_table_range_data->pageCount,
-                    bytesToHumanReadable(buff, sizeof(buff), page_table_range_data->pageCount * PAGE_SIZE),
-                    tableFlagsToString(page_table_range_data->flags), data->mappings[i]->type);
-            data->paging->mapMemory(page_table_range_data->physicalStart, page_table_range_data->virtualStart,
-                                    page_table_range_data->pageSize, page_table_range_data->pageCount,
-                                    page_table_range_data->flags);
-            mapped = true;
-            break;
-          }
-        }
-      }
-      if (!mapped && page_table_range_data->pageCount > 2) {
-        char buff[32];
-        kprintf("not mapping %p-%p/%p-%p %lu(%s) %s\n", toPtr(page_table_range_data->virtualStart),
-                toPtr(page_table_range_data->virtualEnd), toPtr(page_table_range_data->physicalStart),
-                toPtr(page_table_range_data->physicalEnd), page_table_range_data->pageCount,
-                bytesToHumanReadable(buff, sizeof(buff), page_table_range_data->pageCount * PAGE_SIZE),
-                tableFlagsToString(page_table_range_data->flags));
-      }
+    kprintf("current cr3: %p/%p\n", toPtr(cr3), addToPointer(toPtr(cr3), hhdmVirtualOffset));
+
+    uint32_t eax = 0x80000001, ebx, ecx, edx;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    gigaPages = (edx & CPUID_PDPE1GB) != 0;
+    useLimineMemoryMap(count, mappings, hhdmVirtualOffset);
+    const auto mapTable = [hhdmVirtualOffset](const uint64_t physical) {
+      return reinterpret_cast<const uint64_t *>(physical + hhdmVirtualOffset);
     };
-    mapPhysicalToVirtual<callbackData> mapper = [](const uint64_t v, callbackData *d) {
-      return reinterpret_cast<void *>(v + d->hhdmVirtualOffset);
-    };
-    pageTableToRanges(addToPointer(reinterpret_cast<uint64_t *>(cr3), hhdmVirtualOffset), mapper, callback, &data);
-
-    uint64_t rootPhysicalAddress = reinterpret_cast<uint64_t>(root) - kernelVirtualOffset;
-    kprintf("new paging table created at %p/%p using %d temporary tables\n", toPtr(root), toPtr(rootPhysicalAddress),
-            initialPoolUsedCount);
+    RangeIterator ranges(mapTable(cr3 & PAGE_ADDR_MASK), 0, mapTable);
+    PageTableRangeData range;
+    while (ranges.next(range)) {
+      copyLimineRange(range);
+    }
+
+    const auto rootPhysicalAddress = tablePhysical(roots[0]);
+    kprintf("new paging table created at %p/%p using %lu early arena pages\n", toPtr(roots[0]),
+            toPtr(rootPhysicalAddress), earlyArena.usedPages());
+    // limine's layout written out, so the memory types do not depend on what the bootloader left behind. The cr3
+    // load right after drops translations cached with the old attributes.
+    asm volatile("wrmsr"
+                 :
+                 : "c"(MSR_PAT), "a"(static_cast<uint32_t>(PAT_LAYOUT)), "d"(static_cast<uint32_t>(PAT_LAYOUT >> 32))
+                 : "memory");
     asm volatile("mov %0, %%cr3" : : "r"(rootPhysicalAddress) : "memory");
-    kprint("paging enabled\n");
-  }
 
-  void Paging::mapPartial(const uint64_t physical_address, const uint64_t virtual_address, const size_t size,
-                          const uint64_t flags) {
-    const auto new_physical_address = makePageAligned(physical_address);
-    const auto new_virtual_address = makePageAligned(virtual_address);
-    auto new_size = size + PAGE_SIZE - (size % PAGE_SIZE);
-    if (physical_address + size > new_physical_address + new_size) {
-      new_size += PAGE_SIZE;
-    }
-    mapMemory(new_physical_address, new_virtual_address, PAGE_SIZE, new_size / PAGE_SIZE, flags);
+    // kernel mappings are global so they survive switches, PCIDs keep the rest of the tlb across them as well.
+    // PCIDE can only be set while cr3 holds PCID 0, which the load above guarantees.
+    uint64_t cr0, cr4;
+    // copy on write relies on the kernel faulting on read only pages as well
+    asm volatile("mov %%cr0, %0; or %1, %0; mov %0, %%cr0" : "=&r"(cr0) : "i"(CR0_WP) : "memory");
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PGE;
+    eax = 1;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (ecx & CPUID_PCID) {
+      cr4 |= CR4_PCIDE;
+      asids = AsidAllocator(PCID_COUNT);
+    }
+    asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+    activate();
+    kprintf("paging enabled, %u pcids\n", asids.countIds());
   }
 
-  void Paging::mapMemory(uint64_t physical_address, uint64_t virtual_address, const size_t pageSize,
-                         const size_t num_pages, const uint64_t flags) {
-    kprintf("mapping %p-%p to %p-%p (%lu) %s\n", toPtr(virtual_address),
-            toPtr(virtual_address + (num_pages * PAGE_SIZE) - 1), toPtr(physical_address),
-            toPtr(physical_address + (num_pages * PAGE_SIZE) - 1), num_pages, tableFlagsToString(flags));
-    if (physical_address % PAGE_SIZE != 0) {
-      kpanic("physical address must be page aligned");
-    }
-    if (virtual_address % PAGE_SIZE != 0) {
-      kpanicf("virtual address %p is not page aligned %lu\n", toPtr(virtual_address), virtual_address % PAGE_SIZE);
-    }
-
-    for (size_t i = 0; i < num_pages; ++i) {
-      const auto idx = virtualToPageIndexes(virtual_address);
-
-      if (!(root[idx.l1] & PAGE_PRESENT)) {
-        auto *new_pdpt = static_cast<uint64_t *>(GetPagePtr(1));
-        memset(new_pdpt, 0, PAGE_SIZE);
-        root[idx.l1] = adjustPageTableVirtualToPhysical(reinterpret_cast<uint64_t>(new_pdpt)) | PAGE_PRESENT |
-                       PAGE_WRITE | PAGE_USER;
+  void Paging::activate() {
+    const auto result = asids.acquire(asid);
+    auto cr3 = tablePhysical(roots[0]);
+    if (asids.countIds() > 1) {
+      if (result == AsidAllocator::Result::ROLLOVER) {
+        invalidateAll();
       }
-      const auto pdpt = reinterpret_cast<uint64_t *>(adjustPageTablePhysicalToVirtual(root[idx.l1] & ~PAGE_FLAGS_MASK));
-
-      if (!(pdpt[idx.l2] & PAGE_PRESENT)) {
-        auto *new_pd = static_cast<uint64_t *>(GetPagePtr(1));
-        memset(new_pd, 0, PAGE_SIZE);
-        pdpt[idx.l2] = adjustPageTableVirtualToPhysical(reinterpret_cast<uint64_t>(new_pd)) | PAGE_PRESENT |
-                       PAGE_WRITE | PAGE_USER;
-      }
-      const auto pd = reinterpret_cast<uint64_t *>(adjustPageTablePhysicalToVirtual(pdpt[idx.l2] & ~PAGE_FLAGS_MASK));
-
-      if (pageSize == PAGE_SIZE * PAGE_ENTRIES) {
-        kassertf(virtual_address % pageSize == 0, "huge page must be page aligned: %p 0x%x", toPtr(virtual_address),
-                 static_cast<unsigned>(virtual_address % pageSize));
-        // kassertf(physical_address % (PAGE_SIZE * PAGE_ENTRIES) == 0, "huge page must be page aligned: %p 0x%x",
-        //         physical_address, physical_address % (PAGE_SIZE * PAGE_ENTRIES));
-        kprintf("mapping huge page at %p-%p/%p-%p\n", toPtr(virtual_address),
-                toPtr(virtual_address + (PAGE_SIZE * PAGE_ENTRIES) - 1), toPtr(physical_address),
-                toPtr(physical_address + (PAGE_SIZE * PAGE_ENTRIES) - 1));
-        setPageTableEntry(pd, idx.l3, virtual_address, physical_address, flags | PAGE_SIZE_FLAG);
-        virtual_address += PAGE_SIZE * PAGE_ENTRIES;
-        physical_address += PAGE_SIZE * PAGE_ENTRIES;
-        continue;
-      }
-      if (!(pd[idx.l3] & PAGE_PRESENT)) {
-        auto *new_pt = static_cast<uint64_t *>(GetPagePtr(1));
-        memset(new_pt, 0, PAGE_SIZE);
-        pd[idx.l3] = adjustPageTableVirtualToPhysical(reinterpret_cast<uint64_t>(new_pt)) | PAGE_PRESENT | PAGE_WRITE |
-                     PAGE_USER;
-      } else if (pd[idx.l3] & PAGE_SIZE_FLAG) {
-        continue;
-      }
-      const auto pt = reinterpret_cast<uint64_t *>(adjustPageTablePhysicalToVirtual(pd[idx.l3] & ~PAGE_FLAGS_MASK));
-      setPageTableEntry(pt, idx.l4, virtual_address, physical_address, flags);
-      physical_address += PAGE_SIZE;
-      virtual_address += PAGE_SIZE;
+      // whatever the tlb holds for this id is either still ours or was dropped at the rollover
+      cr3 |= asid.id | CR3_NO_FLUSH;
     }
+    asm volatile("mov %0, %%cr3" : : "r"(cr3) : "memory");
+    active = this;
   }
 
-  void Paging::setPageTableEntry(uint64_t *table, const uint16_t index, const uint64_t virtualAddress,
-                                 const uint64_t physicalAddress, const uint64_t flags) {
-    const uint64_t newValue = (physicalAddress & PAGE_ADDR_MASK) | PAGE_PRESENT | flags;
-    if (table[index] != 0 && table[index] != newValue) {
-      kprintf("attempted to overwrite page table entry for %p from %lx to %lx", toPtr(virtualAddress),
-              table[index] & ~PAGE_FLAGS_MASK, newValue & ~PAGE_FLAGS_MASK);
-      const auto oldFlags = table[index] & PAGE_FLAGS_MASK & ~(PAGE_ACCESSED | PAGE_DIRTY);
-      const auto newFlags = newValue & PAGE_FLAGS_MASK & ~(PAGE_ACCESSED | PAGE_DIRTY);
-      if (oldFlags != newFlags) {
-        kprintf(" old flags %s", tableFlagsToString(oldFlags & PAGE_FLAGS_MASK));
-        kprintf(" new flags %s", tableFlagsToString(newFlags & PAGE_FLAGS_MASK));
-      }
-      kprint("\n");
-      kpanic("page table entry already exists");
+  // only drops the entries of the current PCID and global ones, which covers every kernel mapping
+  void Paging::invalidatePage(const uint64_t virtualAddress) {
+    asm volatile("invlpg (%0)" : : "r"(virtualAddress) : "memory");
+  }
+
+  void Paging::invalidateAll() {
+    // reloading cr3 keeps global pages, toggling PGE drops them as well
+    uint64_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+      asm volatile("mov %0, %%cr4; mov %1, %%cr4" : : "r"(cr4 & ~CR4_PGE), "r"(cr4) : "memory");
+    } else {
+      uint64_t cr3;
+      asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
     }
-    table[index] = newValue;
   }
 } // namespace memory
@@ -9,6 +9,7 @@
 #ifdef __KERNEL__
 #include <cstdint>
 #include <limine.h>
+#include "memory/get-page.h"
 
 namespace {
   __attribute__((used, section(".limine_requests"))) volatile limine_framebuffer_request framebuffer_request = {
@@ -16,11 +17,91 @@ namespace {
 }
 #endif
 
+namespace {
+  // the row primitives the drawing operations are built on, using the widest stores each architecture has
+  void fillPixels(uint32_t *destination, size_t count, const uint32_t color) {
+    const auto pattern = color | static_cast<uint64_t>(color) << 32;
+#if defined(__x86_64__)
+    if (count > 0 && reinterpret_cast<uintptr_t>(destination) % 8 != 0) {
+      *destination++ = color;
+      count--;
+    }
+    auto quads = count / 2;
+    asm volatile("rep stosq" : "+D"(destination), "+c"(quads) : "a"(pattern) : "memory");
+    if (count % 2 != 0) {
+      *destination = color;
+    }
+#elif defined(__aarch64__)
+    uint64_t dczid;
+    asm("mrs %0, dczid_el0" : "=r"(dczid));
+    // with DZP clear dc zva zeroes blocks of 4 << BS bytes without reading them first
+    if (color == 0 && !(dczid & (1 << 4))) {
+      const size_t blockPixels = 1 << (dczid & 0xF);
+      while (count > 0 && reinterpret_cast<uintptr_t>(destination) % (blockPixels * 4) != 0) {
+        *destination++ = color;
+        count--;
+      }
+      for (; count >= blockPixels; count -= blockPixels, destination += blockPixels) {
+        asm volatile("dc zva, %0" : : "r"(destination) : "memory");
+      }
+    }
+    while (count > 0 && reinterpret_cast<uintptr_t>(destination) % 16 != 0) {
+      *destination++ = color;
+      count--;
+    }
+    if (auto pairs = count / 4; pairs > 0) {
+      asm volatile("1: stp %2, %2, [%0], #16\n"
+                   "subs %1, %1, #1\n"
+                   "b.ne 1b"
+                   : "+r"(destination), "+r"(pairs)
+                   : "r"(pattern)
+                   : "memory", "cc");
+    }
+    for (size_t i = 0; i < count % 4; i++) {
+      destination[i] = color;
+    }
+#else
+    (void) pattern;
+    for (size_t i = 0; i < count; i++) {
+      destination[i] = color;
+    }
+#endif
+  }
+
+  // copies front to back, destination must not overlap the part of source after it
+  void copyPixels(uint32_t *destination, const uint32_t *source, size_t count) {
+#if defined(__x86_64__)
+    if (count > 0 && reinterpret_cast<uintptr_t>(destination) % 8 != 0) {
+      *destination++ = *source++;
+      count--;
+    }
+    auto quads = count / 2;
+    asm volatile("rep movsq" : "+D"(destination), "+S"(source), "+c"(quads) : : "memory");
+    if (count % 2 != 0) {
+      *destination = *source;
+    }
+#else
+    // pairs of pixels, which the compiler turns into ldp/stp
+    for (; count >= 2; count -= 2, destination += 2, source += 2) {
+      uint64_t pair;
+      __builtin_memcpy(&pair, source, sizeof(pair));
+      __builtin_memcpy(destination, &pair, sizeof(pair));
+    }
+    if (count > 0) {
+      *destination = *source;
+    }
+#endif
+  }
+} // namespace
+
 namespace framebuffer {
 #include "font_data.h"
   Framebuffer defaultFramebuffer;
 
-  Framebuffer::Framebuffer() { this->font = reinterpret_cast<const PSF2_t *>(font_data); }
+  Framebuffer::Framebuffer() {
+    this->font = reinterpret_cast<const PSF2_t *>(font_data);
+    expandNibbles();
+  }
 
 #ifdef __KERNEL__
   void Framebuffer::init() {
@@ -43,6 +124,14 @@ namespace framebuffer {
   }
 
   uint64_t Framebuffer::getFramebufferVirtualAddress() const { return reinterpret_cast<uint64_t>(fb); }
+
+  void Framebuffer::initBackBuffer() {
+    const auto pages = (static_cast<size_t>(height) * pitch + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (const auto buffer = getPage(pages); buffer != nullptr) {
+      setBackBuffer(static_cast<uint32_t *>(buffer));
+      kprintf("framebuffer back buffer at %p\n", buffer);
+    }
+  }
 #endif
 
   void Framebuffer::init(volatile uint32_t *fb, const uint32_t width, const uint32_t height, const uint32_t pitch) {
@@ -50,9 +139,9 @@ namespace framebuffer {
     this->width = width;
     this->height = height;
     this->pitch = pitch;
-    for (uint32_t i = 0; i < width * height; i++) {
-      fb[i] = 0xFF000000;
-    }
+    backBuffer = nullptr;
+    damage = {};
+    clear();
   }
 
   Size Framebuffer::textSize(const char *text) const {
@@ -62,7 +151,7 @@ namespace framebuffer {
     return s;
   }
 
-  void Framebuffer::drawTextAt(const char *text, uint32_t x, uint32_t y) const {
+  void Framebuffer::drawTextAt(const char *text, uint32_t x, uint32_t y) {
     while (*text) {
       drawCharAt(*text, x, y);
       x += font->width;
@@ -74,20 +163,129 @@ namespace framebuffer {
     }
   }
 
-  void Framebuffer::drawCharAt(const char c, const uint32_t x, uint32_t y) const {
+  void Framebuffer::drawCharAt(const char c, const uint32_t x, const uint32_t y) {
+    const auto pixels = canvas();
+    addDamage({x, y, font->width, font->height});
     const auto bpl = (font->width + 7) / 8;
     const unsigned char *glyph =
         font_data + font->headersize + (c > 0 && c < font->numglyph ? c : 0) * font->bytesperglyph;
-    for (int i = 0; i < font->height; i++) {
-      auto line = y * pitch / 4 + x;
-      uint32_t mask = 1 << (font->width - 1);
-      for (int j = 0; j < font->width; j++) {
-        fb[line] = (*glyph & mask) ? 0xFFFFFFFF : 0xFF000000;
-        mask >>= 1;
-        line++;
+    auto row = pixels + static_cast<size_t>(y) * (pitch / 4) + x;
+    for (uint32_t i = 0; i < font->height; i++) {
+      uint32_t j = 0;
+      // rows are stored most significant bit first, high nibble before low nibble
+      for (; j + 4 <= font->width; j += 4) {
+        __builtin_memcpy(row + j, nibblePixels[glyph[j / 8] >> (4 - j % 8) & 0xF], sizeof(nibblePixels[0]));
+      }
+      if (j < font->width) {
+        const auto &span = nibblePixels[glyph[j / 8] >> (4 - j % 8) & 0xF];
+        for (uint32_t k = 0; j + k < font->width; k++) {
+          row[j + k] = span[k];
+        }
       }
       glyph += bpl;
-      y++;
+      row += pitch / 4;
+    }
+  }
+
+  void Framebuffer::setColors(const uint32_t foreground, const uint32_t background) {
+    this->foreground = foreground;
+    this->background = background;
+    expandNibbles();
+  }
+
+  void Framebuffer::expandNibbles() {
+    for (uint32_t nibble = 0; nibble < 16; nibble++) {
+      for (uint32_t bit = 0; bit < 4; bit++) {
+        nibblePixels[nibble][bit] = (nibble & (8 >> bit)) ? foreground : background;
+      }
+    }
+  }
+
+  void Framebuffer::fillRect(const Rect &rect, const uint32_t color) {
+    const auto right = rect.x + rect.width < width ? rect.x + rect.width : width;
+    const auto bottom = rect.y + rect.height < height ? rect.y + rect.height : height;
+    if (rect.x >= right) {
+      return;
+    }
+    const auto pixels = canvas();
+    for (auto y = rect.y; y < bottom; y++) {
+      fillPixels(pixels + static_cast<size_t>(y) * (pitch / 4) + rect.x, right - rect.x, color);
+    }
+    addDamage(rect);
+  }
+
+  void Framebuffer::clear() { clear({0, 0, width, height}); }
+
+  void Framebuffer::clear(const Rect &rect) { fillRect(rect, background); }
+
+  void Framebuffer::blit(const Rect &source, const uint32_t x, const uint32_t y) {
+    const auto pixels = canvas();
+    const auto stride = pitch / 4;
+    const auto row = [&](const uint32_t i) {
+      const auto from = pixels + static_cast<size_t>(source.y + i) * stride + source.x;
+      const auto to = pixels + static_cast<size_t>(y + i) * stride + x;
+      if (y == source.y && x > source.x) {
+        // moving right within the same row has to go back to front
+        memmove(to, from, source.width * sizeof(uint32_t));
+      } else {
+        copyPixels(to, from, source.width);
+      }
+    };
+    // rows are copied away from the direction of the move, so no row is overwritten before it has been read
+    if (y <= source.y) {
+      for (uint32_t i = 0; i < source.height; i++) {
+        row(i);
+      }
+    } else {
+      for (auto i = source.height; i > 0; i--) {
+        row(i - 1);
+      }
+    }
+    addDamage({x, y, source.width, source.height});
+  }
+
+  void Framebuffer::setBackBuffer(uint32_t *buffer) {
+    for (uint32_t y = 0; y < height; y++) {
+      copyPixels(buffer + static_cast<size_t>(y) * (pitch / 4), const_cast<uint32_t *>(fb) + y * (pitch / 4), width);
+    }
+    backBuffer = buffer;
+    damage = {};
+  }
+
+  void Framebuffer::addDamage(const Rect &rect) {
+    if (backBuffer == nullptr || rect.width == 0 || rect.height == 0) {
+      return;
+    }
+    if (damage.width == 0) {
+      damage = rect;
+      return;
+    }
+    const auto right = damage.x + damage.width > rect.x + rect.width ? damage.x + damage.width : rect.x + rect.width;
+    const auto bottom =
+        damage.y + damage.height > rect.y + rect.height ? damage.y + damage.height : rect.y + rect.height;
+    damage.x = damage.x < rect.x ? damage.x : rect.x;
+    damage.y = damage.y < rect.y ? damage.y : rect.y;
+    damage.width = right - damage.x;
+    damage.height = bottom - damage.y;
+  }
+
+  void Framebuffer::present() {
+    if (damage.width != 0) {
+      present(damage);
+      damage = {};
+    }
+  }
+
+  void Framebuffer::present(const Rect &rect) const {
+    if (backBuffer == nullptr) {
+      return;
+    }
+    const auto right = rect.x + rect.width < width ? rect.x + rect.width : width;
+    const auto bottom = rect.y + rect.height < height ? rect.y + rect.height : height;
+    // the stores are 8 byte aligned, which the write combining buffers merge into full lines
+    for (auto y = rect.y; y < bottom && rect.x < right; y++) {
+      const auto row = static_cast<size_t>(y) * (pitch / 4) + rect.x;
+      copyPixels(const_cast<uint32_t *>(fb) + row, backBuffer + row, right - rect.x);
     }
   }
 
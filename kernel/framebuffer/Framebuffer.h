@@ -11,6 +11,15 @@ namespace framebuffer {
     uint32_t height;
   };
 
+  struct Rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  // Draws text onto a linear 32 bpp framebuffer. With a back buffer set, drawing goes to that copy in cached memory
+  // and present() writes the changed part of it out to the screen.
   class Framebuffer {
   public:
     [[nodiscard]] Framebuffer();
@@ -18,12 +27,26 @@ namespace framebuffer {
     void init();
     void postInit() const;
     [[nodiscard]] uint64_t getFramebufferVirtualAddress() const;
+    // switches to a back buffer from the frame allocator, stays with direct drawing if there is no memory for it
+    void initBackBuffer();
 #endif
     void init(volatile uint32_t *fb, uint32_t width, uint32_t height, uint32_t pitch);
     Size textSize(const char *text) const;
 
-    void drawTextAt(const char *text, uint32_t x, uint32_t y) const;
-    void drawCharAt(char c, uint32_t x, uint32_t y) const;
+    void drawTextAt(const char *text, uint32_t x, uint32_t y);
+    void drawCharAt(char c, uint32_t x, uint32_t y);
+    void setColors(uint32_t foreground, uint32_t background);
+    void fillRect(const Rect &rect, uint32_t color);
+    // fills with the background colour
+    void clear();
+    void clear(const Rect &rect);
+    // copies source to x, y, the two may overlap but have to lie on the screen
+    void blit(const Rect &source, uint32_t x, uint32_t y);
+    // buffer has to hold height * pitch bytes, the current screen is copied into it
+    void setBackBuffer(uint32_t *buffer);
+    // copies what was drawn since the last present to the screen
+    void present();
+    void present(const Rect &rect) const;
     [[nodiscard]] Size getResolution() const;
 
   protected:
@@ -32,6 +55,18 @@ namespace framebuffer {
     uint32_t height = 0;
     uint32_t pitch = 0;
     const PSF2_t *font;
+    uint32_t foreground = 0xFFFFFFFF;
+    uint32_t background = 0xFF000000;
+    // the four pixels each nibble of a glyph row expands to, so a row is drawn as a few 16 byte copies
+    uint32_t nibblePixels[16][4] = {};
+    uint32_t *backBuffer = nullptr;
+    // the part of the back buffer that differs from the screen, empty when width is 0
+    Rect damage{};
+
+    // where drawing goes, the back buffer if there is one
+    [[nodiscard]] uint32_t *canvas() const { return backBuffer != nullptr ? backBuffer : const_cast<uint32_t *>(fb); }
+    void addDamage(const Rect &rect);
+    void expandNibbles();
   };
 
   extern Framebuffer defaultFramebuffer;
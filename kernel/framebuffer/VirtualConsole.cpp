@@ -8,10 +8,10 @@
 #endif
 
 namespace framebuffer {
-#define MAX_RES_WIDTH 1280
-#define MAX_RES_HEIGHT 1024
-  constexpr auto bufferSize = (MAX_RES_WIDTH / 8) * (MAX_RES_HEIGHT / 16);
+  constexpr auto bufferSize = (MAX_RES_WIDTH / 8) * MAX_LINES;
   char buffer[bufferSize];
+  // the characters currently on the screen
+  char displayed[bufferSize];
   VirtualConsole defaultVirtualConsole;
 
 #ifdef __KERNEL__
@@ -73,26 +73,74 @@ namespace framebuffer {
     }
     lineLength = resWidth / fontSize.width;
     lineCount = resHeight / fontSize.height;
+    // blank cells need no glyph, so the grid starts out as spaces on a cleared screen
+    framebuffer->clear(textArea());
+    memset(displayed, ' ', sizeof(displayed));
     initComplete = true;
     updateScreen();
   }
 
-  void VirtualConsole::updateScreen() const {
-    if (initComplete) {
-      for (int x = 0; x < lineLength; x++) {
-        for (int y = 0; y < lineCount; y++) {
+  Rect VirtualConsole::textArea() const {
+    return {0, 0, static_cast<uint32_t>(lineLength * fontSize.width),
+            static_cast<uint32_t>(lineCount * fontSize.height)};
+  }
+
+  void VirtualConsole::markAllDirty() {
+    for (size_t y = 0; y < lineCount; y++) {
+      markDirty(y);
+    }
+  }
+
+  void VirtualConsole::scroll() {
+    memmove(buffer, buffer + lineLength, lineLength * (lineCount - 1));
+    memset(buffer + lineLength * (lineCount - 1), ' ', lineLength);
+    // the dirty lines move up with the text, line 0 falls off the top
+    constexpr auto words = MAX_LINES / 64;
+    for (size_t word = 0; word < words; word++) {
+      dirtyLines[word] = dirtyLines[word] >> 1 | (word + 1 < words ? dirtyLines[word + 1] << 63 : 0);
+    }
+    markDirty(lineCount - 1);
+    pendingScroll++;
+  }
+
+  void VirtualConsole::updateScreen() {
+    if (!initComplete) {
+      return;
+    }
+    if (pendingScroll >= lineCount) {
+      framebuffer->clear(textArea());
+      memset(displayed, ' ', sizeof(displayed));
+      markAllDirty();
+    } else if (pendingScroll > 0) {
+      // the screen and displayed move together, which leaves every line that was not written to up to date
+      const auto lines = lineCount - pendingScroll;
+      auto source = textArea();
+      source.y = static_cast<uint32_t>(pendingScroll * fontSize.height);
+      source.height = static_cast<uint32_t>(lines * fontSize.height);
+      framebuffer->blit(source, 0, 0);
+      memmove(displayed, displayed + pendingScroll * lineLength, lines * lineLength);
+    }
+    pendingScroll = 0;
+    for (size_t word = 0; word < MAX_LINES / 64; word++) {
+      while (dirtyLines[word] != 0) {
+        const auto y = word * 64 + __builtin_ctzll(dirtyLines[word]);
+        dirtyLines[word] &= dirtyLines[word] - 1;
+        for (size_t x = 0; x < lineLength; x++) {
           const auto i = (y * lineLength) + x;
-          if (i < bufferSize) {
+          if (i < bufferSize && displayed[i] != buffer[i]) {
             framebuffer->drawCharAt(buffer[i], x * fontSize.width, y * fontSize.height);
+            displayed[i] = buffer[i];
           }
         }
       }
     }
+    framebuffer->present();
   }
 
   void VirtualConsole::appendText(const char *text) {
     writeToSerial(text);
     while (*text) {
+      markDirty(cursorY);
       if (*text == '\n') {
         for (; cursorX < lineLength; cursorX++) {
           buffer[(cursorY * lineLength) + cursorX] = ' ';
@@ -106,8 +154,7 @@ namespace framebuffer {
         cursorX = 0;
         cursorY++;
         if (cursorY >= lineCount) {
-          memmove(buffer, buffer + lineLength, lineLength * (lineCount - 1));
-          memset(buffer + lineLength * (lineCount - 1), ' ', lineLength);
+          scroll();
           cursorY--;
         }
       }
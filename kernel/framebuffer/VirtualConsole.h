@@ -9,6 +9,14 @@
 #define kprint(msg) framebuffer::defaultVirtualConsole.appendText(msg)
 
 namespace framebuffer {
+  // A text grid drawn onto a framebuffer. Only lines marked dirty are looked at when the screen is updated, and of
+  // those only the cells that differ from what was drawn last are rasterised again. Scrolling moves the pixels that
+  // are already on the screen, so only the line that comes in has to be drawn.
+  constexpr size_t MAX_RES_WIDTH = 1280;
+  constexpr size_t MAX_RES_HEIGHT = 1024;
+  // a font is at least 8x16 pixels
+  constexpr size_t MAX_LINES = MAX_RES_HEIGHT / 16;
+
   class VirtualConsole {
   public:
 #ifdef __KERNEL__
@@ -28,8 +36,17 @@ namespace framebuffer {
     size_t lineCount = 10;
     Size fontSize{};
     bool initComplete = false;
-
-    void updateScreen() const;
+    // one bit per line with cells that may differ from the screen
+    uint64_t dirtyLines[MAX_LINES / 64] = {};
+    // lines the text scrolled by since the screen was last updated
+    size_t pendingScroll = 0;
+
+    void markDirty(size_t line) { dirtyLines[line / 64] |= 1ull << (line % 64); }
+    // the pixels the grid covers
+    [[nodiscard]] Rect textArea() const;
+    void markAllDirty();
+    void scroll();
+    void updateScreen();
     void writeToSerial(const char *text);
   };
 #ifdef __KERNEL__
@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+#include <vector>
+#include "Framebuffer.h"
+
+namespace {
+  constexpr auto WIDTH = 1024;
+  constexpr auto HEIGHT = 768;
+
+  // the renderer before the nibble expansion, testing one bit per pixel, kept as the baseline
+  class BitByBitFramebuffer : public framebuffer::Framebuffer {
+  public:
+    void drawCharBitByBit(const char c, const uint32_t x, uint32_t y) const {
+      const auto bpl = (font->width + 7) / 8;
+      const unsigned char *glyph = reinterpret_cast<const unsigned char *>(font) + font->headersize +
+                                   (c > 0 && c < font->numglyph ? c : 0) * font->bytesperglyph;
+      for (uint32_t i = 0; i < font->height; i++) {
+        auto line = y * pitch / 4 + x;
+        uint32_t mask = 1 << (font->width - 1);
+        for (uint32_t j = 0; j < font->width; j++) {
+          fb[line] = (*glyph & mask) ? 0xFFFFFFFF : 0xFF000000;
+          mask >>= 1;
+          line++;
+        }
+        glyph += bpl;
+        y++;
+      }
+    }
+  };
+
+  // fills the screen with glyphs, one iteration draws every cell once
+  template<typename Draw>
+  void drawScreens(benchmark::State &state, BitByBitFramebuffer &fb, Draw draw) {
+    const auto [fontWidth, fontHeight] = fb.textSize(" ");
+    const auto columns = WIDTH / fontWidth;
+    const auto lines = HEIGHT / fontHeight;
+    for (auto _: state) {
+      for (uint32_t y = 0; y < lines; y++) {
+        for (uint32_t x = 0; x < columns; x++) {
+          draw(static_cast<char>(' ' + (x + y) % 95), x * fontWidth, y * fontHeight);
+        }
+      }
+      benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * columns * lines));
+  }
+
+  void BM_DrawGlyphsBitByBit(benchmark::State &state) {
+    std::vector<uint32_t> screen(WIDTH * HEIGHT);
+    BitByBitFramebuffer fb;
+    fb.init(screen.data(), WIDTH, HEIGHT, WIDTH * 4);
+    drawScreens(state, fb, [&fb](const char c, const uint32_t x, const uint32_t y) { fb.drawCharBitByBit(c, x, y); });
+  }
+
+  void BM_DrawGlyphs(benchmark::State &state) {
+    std::vector<uint32_t> screen(WIDTH * HEIGHT);
+    BitByBitFramebuffer fb;
+    fb.init(screen.data(), WIDTH, HEIGHT, WIDTH * 4);
+    drawScreens(state, fb, [&fb](const char c, const uint32_t x, const uint32_t y) { fb.drawCharAt(c, x, y); });
+  }
+
+  // drawing into a back buffer and presenting the whole screen once per iteration
+  void BM_DrawGlyphsBackBuffer(benchmark::State &state) {
+    std::vector<uint32_t> screen(WIDTH * HEIGHT);
+    std::vector<uint32_t> back(WIDTH * HEIGHT);
+    BitByBitFramebuffer fb;
+    fb.init(screen.data(), WIDTH, HEIGHT, WIDTH * 4);
+    fb.setBackBuffer(back.data());
+    drawScreens(state, fb, [&fb](const char c, const uint32_t x, const uint32_t y) {
+      fb.drawCharAt(c, x, y);
+      if (x == 0 && y == 0) {
+        fb.present();
+      }
+    });
+  }
+} // namespace
+
+BENCHMARK(BM_DrawGlyphsBitByBit);
+BENCHMARK(BM_DrawGlyphs);
+BENCHMARK(BM_DrawGlyphsBackBuffer);
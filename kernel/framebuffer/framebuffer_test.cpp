@@ -1,4 +1,5 @@
 #include "Framebuffer.h"
+#include <algorithm>
 #include <fstream>
 #include <gtest/gtest.h>
 #include <vector>
@@ -43,3 +44,162 @@ TEST(Framebuffer, draw_text) {
 
   // EXPECT_TRUE(false) << fb.textSize(" ").height << " " << fb.textSize(" ").width;
 }
+
+TEST(VirtualConsole, only_redraws_changed_cells) {
+  constexpr auto width = 640;
+  constexpr auto height = 480;
+  std::vector<uint32_t> framebuffer(width * height);
+  framebuffer::Framebuffer fb;
+  fb.init(framebuffer.data(), width, height, width * 4);
+  framebuffer::VirtualConsole vc;
+  vc.init(&fb);
+  vc.appendText("ab");
+
+  const auto [fontWidth, fontHeight] = fb.textSize(" ");
+  // marks the first pixel of the cells of "a", "b" and the one after them as well as a cell on the next line
+  constexpr uint32_t marker = 0x12345678;
+  for (const auto x: {0u, fontWidth, 2 * fontWidth}) {
+    framebuffer[x] = marker;
+  }
+  framebuffer[fontHeight * width] = marker;
+
+  vc.appendText("c");
+  EXPECT_EQ(framebuffer[0], marker);
+  EXPECT_EQ(framebuffer[fontWidth], marker);
+  EXPECT_NE(framebuffer[2 * fontWidth], marker);
+  EXPECT_EQ(framebuffer[fontHeight * width], marker);
+}
+
+TEST(VirtualConsole, scrolling_moves_pixels) {
+  constexpr auto width = 640;
+  constexpr auto height = 480;
+  std::vector<uint32_t> framebuffer(width * height);
+  framebuffer::Framebuffer fb;
+  fb.init(framebuffer.data(), width, height, width * 4);
+  framebuffer::VirtualConsole vc;
+  vc.init(&fb);
+
+  const auto [fontWidth, fontHeight] = fb.textSize(" ");
+  const auto lines = height / fontHeight;
+  for (uint32_t i = 0; i < lines - 1; i++) {
+    vc.appendText(i == 1 ? "x\n" : "\n");
+  }
+  std::vector<uint32_t> secondLine(framebuffer.begin() + fontHeight * width,
+                                   framebuffer.begin() + 2 * fontHeight * width);
+  // a pixel only the row copy carries to the first line, redrawing the cell would overwrite it
+  constexpr uint32_t marker = 0x12345678;
+  secondLine[fontWidth * 2] = marker;
+  framebuffer[fontHeight * width + fontWidth * 2] = marker;
+
+  vc.appendText("\n");
+  EXPECT_TRUE(std::equal(secondLine.begin(), secondLine.end(), framebuffer.begin()));
+}
+
+TEST(Framebuffer, back_buffer_is_presented) {
+  constexpr auto width = 640;
+  constexpr auto height = 480;
+  std::vector<uint32_t> direct(width * height);
+  std::vector<uint32_t> screen(width * height);
+  std::vector<uint32_t> back(width * height);
+  framebuffer::Framebuffer directFb;
+  directFb.init(direct.data(), width, height, width * 4);
+  framebuffer::Framebuffer fb;
+  fb.init(screen.data(), width, height, width * 4);
+  fb.setBackBuffer(back.data());
+
+  // an odd x checks the unaligned start of a row
+  directFb.drawTextAt("back buffer", 3, 5);
+  fb.drawTextAt("back buffer", 3, 5);
+  EXPECT_NE(direct, screen);
+  fb.present();
+  EXPECT_EQ(direct, screen);
+
+  // what was presented once is not written again
+  screen[0] = 0x12345678;
+  fb.present();
+  EXPECT_EQ(screen[0], 0x12345678);
+}
+
+TEST(VirtualConsole, back_buffer_matches_direct_drawing) {
+  constexpr auto width = 640;
+  constexpr auto height = 480;
+  std::vector<uint32_t> direct(width * height);
+  std::vector<uint32_t> screen(width * height);
+  std::vector<uint32_t> back(width * height);
+  framebuffer::Framebuffer directFb;
+  directFb.init(direct.data(), width, height, width * 4);
+  framebuffer::Framebuffer fb;
+  fb.init(screen.data(), width, height, width * 4);
+  fb.setBackBuffer(back.data());
+
+  // one after the other, the consoles share their text buffer
+  for (auto target: {&directFb, &fb}) {
+    framebuffer::VirtualConsole vc;
+    vc.init(target);
+    char buf[64];
+    for (int i = 0; i < 100; i++) {
+      snprintf(buf, sizeof(buf), "\n%d hi all", i);
+      vc.appendText(buf);
+    }
+  }
+  EXPECT_EQ(direct, screen);
+}
+
+TEST(Framebuffer, draws_in_the_set_colors) {
+  constexpr auto width = 64;
+  constexpr auto height = 32;
+  std::vector<uint32_t> screen(width * height);
+  framebuffer::Framebuffer fb;
+  fb.init(screen.data(), width, height, width * 4);
+  fb.drawCharAt('#', 0, 0);
+  const auto white = std::count(screen.begin(), screen.end(), 0xFFFFFFFF);
+  EXPECT_GT(white, 0);
+
+  fb.setColors(0xFF00FF00, 0xFF0000FF);
+  fb.drawCharAt('#', 0, 0);
+  const auto [fontWidth, fontHeight] = fb.textSize(" ");
+  EXPECT_EQ(std::count(screen.begin(), screen.end(), 0xFF00FF00), white);
+  EXPECT_EQ(std::count(screen.begin(), screen.end(), 0xFF0000FF), static_cast<long>(fontWidth * fontHeight) - white);
+}
+
+TEST(Framebuffer, fill_and_blit_respect_pitch) {
+  constexpr auto width = 60;
+  constexpr auto height = 20;
+  // four pixels of padding at the end of every row
+  constexpr auto stride = width + 4;
+  constexpr uint32_t padding = 0xDEADBEEF;
+  std::vector<uint32_t> screen(stride * height, padding);
+  framebuffer::Framebuffer fb;
+  fb.init(screen.data(), width, height, stride * 4);
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < stride; x++) {
+      EXPECT_EQ(screen[y * stride + x], x < width ? 0xFF000000 : padding);
+    }
+  }
+
+  // odd positions and sizes take the unaligned edges
+  fb.fillRect({3, 2, 7, 3}, 0xFF112233);
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      const auto inside = x >= 3 && x < 10 && y >= 2 && y < 5;
+      EXPECT_EQ(screen[y * stride + x], inside ? 0xFF112233 : 0xFF000000);
+    }
+  }
+
+  // overlapping moves down and to the right
+  fb.blit({3, 2, 7, 3}, 4, 3);
+  fb.blit({4, 3, 7, 3}, 5, 3);
+  for (uint32_t y = 0; y < height; y++) {
+    for (uint32_t x = 0; x < width; x++) {
+      // the first blit leaves column 3 of rows 3 and 4 behind, the second one column 4
+      const auto first = x >= 3 && x < 10 && y >= 2 && y < 5;
+      const auto moved = x >= 4 && x < 12 && y >= 3 && y < 6;
+      const auto inside = first || moved;
+      EXPECT_EQ(screen[y * stride + x], inside ? 0xFF112233 : 0xFF000000) << x << "," << y;
+    }
+  }
+  EXPECT_EQ(screen[width], padding);
+
+  fb.clear();
+  EXPECT_EQ(std::count(screen.begin(), screen.end(), 0xFF000000), width * height);
+}
@@ -4,7 +4,10 @@
 #include <limine.h>
 
 #include <framebuffer/VirtualConsole.h>
+#include <interrupts/Interrupts.h>
+#include <memory/AllocatorStats.h>
 #include <memory/MemMap.h>
+#include <memory/paging.h>
 #include <serial/Serial.h>
 #include <smbios/smbios.h>
 
@@ -108,8 +111,11 @@ extern "C" void kmain() {
     __init_array[i]();
   }
 
+  interrupts::defaultInterrupts.init();
   framebuffer::defaultVirtualConsole.init();
   memory::memMap.init();
+  // drawing in cached memory needs the frame allocator memMap sets up
+  framebuffer::defaultFramebuffer.initBackBuffer();
   serial::defaultSerial.init(memory::hhdm_request.response->offset);
 
   if (dtb.response != nullptr) {
@@ -131,6 +137,9 @@ extern "C" void kmain() {
   }
 
   smbios::defaultSMBIOS.init(memory::hhdm_request.response->offset);
+  dumpAllocatorStats();
+  memory::paging.mapTrace().dump(
+      [](const char *text, const size_t length) { serial::defaultSerial.write(text, length); });
   kprint("start complete\n");
   halt();
 }
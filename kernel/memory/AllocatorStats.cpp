@@ -0,0 +1,57 @@
+#include "AllocatorStats.h"
+#include <cstdio>
+#include "BuddyAllocator.h"
+#include "PerCpuCache.h"
+#include "SlabAllocator.h"
+#include "memalloc.h"
+#ifdef __KERNEL__
+#include "memory/paging.h"
+#include "serial/Serial.h"
+#endif
+
+void StatsFormatter::value(const char *key, const uint64_t value) const {
+  char buf[128];
+  const auto n = ksnprintf(buf, sizeof(buf), "%s.%s=%lu\n", prefix, key, value);
+  write(buf, n < static_cast<int>(sizeof(buf)) ? n : sizeof(buf) - 1);
+}
+
+void StatsFormatter::value(const char *key, const uint64_t index, const uint64_t value) const {
+  char buf[128];
+  const auto n = ksnprintf(buf, sizeof(buf), "%s.%s.%lu=%lu\n", prefix, key, index, value);
+  write(buf, n < static_cast<int>(sizeof(buf)) ? n : sizeof(buf) - 1);
+}
+
+uint64_t fragmentationPerMille(const size_t freeSize, const size_t largestFree) {
+  if (freeSize == 0) {
+    return 0;
+  }
+  return 1000 - largestFree * 1000 / freeSize;
+}
+
+void writeAllocatorStats(const statsWriter_t write) {
+  write("alloc.begin\n", 12);
+  StatsFormatter out(write, "pool");
+  defaultPool.writeStats(out);
+  out.setPrefix("slab");
+  defaultSlab.writeStats(out);
+  out.setPrefix("cpu_cache");
+  defaultCpuCache.writeStats(out);
+  out.setPrefix("frames");
+  memory::frameAllocator.writeStats(out);
+#ifdef __KERNEL__
+  out.setPrefix("paging");
+  out.value("hhdm_faults", memory::paging.countFaults());
+  out.value("hhdm_fault_bytes", memory::paging.faultMappedSize());
+  out.setPrefix("tlb");
+  memory::paging.tlbBatch().writeStats(out);
+  out.setPrefix("asid");
+  memory::Paging::asidAllocator().writeStats(out);
+#endif
+  write("alloc.end\n", 10);
+}
+
+#ifdef __KERNEL__
+void dumpAllocatorStats() {
+  writeAllocatorStats([](const char *text, const size_t length) { serial::defaultSerial.write(text, length); });
+}
+#endif
@@ -0,0 +1,36 @@
+#ifndef ALLOCATORSTATS_H
+#define ALLOCATORSTATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+typedef void (*statsWriter_t)(const char *text, size_t length);
+
+// Writes statistics as one "prefix.key=value" or "prefix.key.index=value" line each, so a dump can be grepped or
+// parsed without knowing which allocators produced it.
+class StatsFormatter {
+public:
+  [[nodiscard]] explicit StatsFormatter(const statsWriter_t write, const char *prefix) :
+      write(write), prefix(prefix) {}
+
+  void setPrefix(const char *newPrefix) { prefix = newPrefix; }
+
+  void value(const char *key, uint64_t value) const;
+  void value(const char *key, uint64_t index, uint64_t value) const;
+
+protected:
+  statsWriter_t write;
+  const char *prefix;
+};
+
+// fragmentation in per mille: how much of the free memory is not part of the largest free block
+[[nodiscard]] uint64_t fragmentationPerMille(size_t freeSize, size_t largestFree);
+
+// dump every default allocator between "alloc.begin" and "alloc.end" lines
+void writeAllocatorStats(statsWriter_t write);
+
+#ifdef __KERNEL__
+void dumpAllocatorStats();
+#endif
+
+#endif // ALLOCATORSTATS_H
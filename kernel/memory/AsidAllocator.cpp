@@ -0,0 +1,29 @@
+#include "AsidAllocator.h"
+#include "AllocatorStats.h"
+
+namespace memory {
+  AsidAllocator::Result AsidAllocator::acquire(Asid &asid) {
+    if (asid.generation == generation) {
+      return Result::VALID;
+    }
+    auto result = Result::NEW;
+    if (next >= count) {
+      // with a single id there is nothing to hand out, every switch becomes a flush
+      generation++;
+      rollovers++;
+      next = 1;
+      result = Result::ROLLOVER;
+    }
+    asid.generation = generation;
+    asid.id = next < count ? next++ : 0;
+    allocations++;
+    return result;
+  }
+
+  void AsidAllocator::writeStats(const StatsFormatter &out) const {
+    out.value("ids", count);
+    out.value("generation", generation);
+    out.value("allocations", allocations);
+    out.value("rollovers", rollovers);
+  }
+} // namespace memory
@@ -0,0 +1,52 @@
+#ifndef ASIDALLOCATOR_H
+#define ASIDALLOCATOR_H
+
+#include <cstdint>
+
+class StatsFormatter;
+
+namespace memory {
+  // Hands out the hardware address space ids that tag tlb entries (PCIDs on x86_64, ASIDs on aarch64). Every id is
+  // stamped with the generation it was given out in. Ids are never freed one by one, once they run out the generation
+  // is bumped and numbering starts over, which is the one point where the whole tlb has to be flushed.
+  class AsidAllocator {
+  public:
+    struct Asid {
+      // 0 is never a live generation, so a default constructed Asid is unassigned
+      uint64_t generation = 0;
+      uint32_t id = 0;
+    };
+
+    enum class Result {
+      // the id is still valid, the tlb entries tagged with it can be kept
+      VALID,
+      // a fresh id that nothing in the tlb is tagged with
+      NEW,
+      // a fresh id from a new generation, entries of the previous one have to be flushed everywhere
+      ROLLOVER,
+    };
+
+    AsidAllocator() = default;
+
+    // id 0 is kept for the boot tables that were live before the allocator existed
+    [[nodiscard]] explicit AsidAllocator(const uint32_t count) : count(count) {}
+
+    Result acquire(Asid &asid);
+
+    [[nodiscard]] uint32_t countIds() const { return count; }
+    [[nodiscard]] uint64_t currentGeneration() const { return generation; }
+    [[nodiscard]] uint64_t countAllocations() const { return allocations; }
+    [[nodiscard]] uint64_t countRollovers() const { return rollovers; }
+
+    void writeStats(const StatsFormatter &out) const;
+
+  protected:
+    uint32_t count = 1;
+    uint32_t next = 1;
+    uint64_t generation = 1;
+    uint64_t allocations = 0;
+    uint64_t rollovers = 0;
+  };
+} // namespace memory
+
+#endif // ASIDALLOCATOR_H
@@ -0,0 +1,205 @@
+#include "BuddyAllocator.h"
+#include "AllocatorStats.h"
+#include "utils/debug.h"
+
+namespace memory {
+  namespace {
+    constexpr uint32_t NIL = ~0u;
+    constexpr uint8_t STATE_FREE = 0x80;
+    constexpr uint8_t STATE_ALLOCATED = 0x40;
+    constexpr uint8_t STATE_ORDER_MASK = 0x1F;
+    constexpr uint64_t MAX_BLOCK_SIZE = static_cast<uint64_t>(PAGE_SIZE) << BuddyAllocator::MAX_ORDER;
+  } // namespace
+
+  BuddyAllocator frameAllocator;
+
+  size_t BuddyAllocator::metadataSize(const uint64_t physicalStart, const uint64_t physicalEnd) {
+    const auto start = physicalStart & ~(MAX_BLOCK_SIZE - 1);
+    const auto pages = (physicalEnd - start + PAGE_SIZE - 1) / PAGE_SIZE;
+    return pages * (sizeof(Link) + sizeof(uint8_t));
+  }
+
+  size_t BuddyAllocator::orderFor(const size_t pages) {
+    size_t order = 0;
+    while ((static_cast<size_t>(1) << order) < pages) {
+      order++;
+    }
+    return order;
+  }
+
+  void BuddyAllocator::init(const uint64_t physicalStart, const uint64_t physicalEnd, void *metadata,
+                            const uint64_t virtualOffset) {
+    LockGuard guard(lock);
+    // align the base so block alignment in the index space is also alignment in physical memory
+    base = physicalStart & ~(MAX_BLOCK_SIZE - 1);
+    pageCount = (physicalEnd - base + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pageCount >= NIL) {
+      pageCount = NIL - 1;
+    }
+    this->virtualOffset = virtualOffset;
+    links = static_cast<Link *>(metadata);
+    state = reinterpret_cast<uint8_t *>(links + pageCount);
+    for (uint64_t i = 0; i < pageCount; i++) {
+      state[i] = 0;
+    }
+    for (auto &list: freeLists) {
+      list = NIL;
+    }
+    nonEmptyOrders = 0;
+    freePageCount = 0;
+    totalPageCount = 0;
+  }
+
+  void BuddyAllocator::push(const uint64_t index, const size_t order) {
+    state[index] = STATE_FREE | order;
+    links[index].prev = NIL;
+    links[index].next = freeLists[order];
+    if (freeLists[order] != NIL) {
+      links[freeLists[order]].prev = index;
+    }
+    freeLists[order] = index;
+    nonEmptyOrders |= 1u << order;
+  }
+
+  void BuddyAllocator::remove(const uint64_t index, const size_t order) {
+    const auto &link = links[index];
+    if (link.prev != NIL) {
+      links[link.prev].next = link.next;
+    } else {
+      freeLists[order] = link.next;
+    }
+    if (link.next != NIL) {
+      links[link.next].prev = link.prev;
+    }
+    if (freeLists[order] == NIL) {
+      nonEmptyOrders &= ~(1u << order);
+    }
+    state[index] = 0;
+  }
+
+  void BuddyAllocator::freeBlock(uint64_t index, size_t order) {
+    freePageCount += static_cast<size_t>(1) << order;
+    // the page stops being an allocated head even if it is merged into a lower buddy, a later free of it is ignored
+    state[index] = 0;
+    while (order < MAX_ORDER) {
+      const auto buddy = index ^ (static_cast<uint64_t>(1) << order);
+      if (buddy >= pageCount || state[buddy] != (STATE_FREE | order)) {
+        break;
+      }
+      remove(buddy, order);
+      if (buddy < index) {
+        index = buddy;
+      }
+      order++;
+    }
+    push(index, order);
+  }
+
+  void BuddyAllocator::addRange(const uint64_t physical, const uint64_t length) {
+    LockGuard guard(lock);
+    auto start = (physical + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    auto end = (physical + length) / PAGE_SIZE * PAGE_SIZE;
+    if (start < base) {
+      start = base;
+    }
+    if (end > base + pageCount * PAGE_SIZE) {
+      end = base + pageCount * PAGE_SIZE;
+    }
+    if (start >= end) {
+      return;
+    }
+    auto index = (start - base) / PAGE_SIZE;
+    const auto endIndex = (end - base) / PAGE_SIZE;
+    DEBUG_PRINT("Adding pages " << index << "-" << endIndex << " to buddy allocator");
+    totalPageCount += endIndex - index;
+    while (index < endIndex) {
+      size_t order = 0;
+      while (order < MAX_ORDER && (index & ((static_cast<uint64_t>(2) << order) - 1)) == 0 &&
+             index + (static_cast<uint64_t>(2) << order) <= endIndex) {
+        order++;
+      }
+      freeBlock(index, order);
+      index += static_cast<uint64_t>(1) << order;
+    }
+  }
+
+  uint64_t BuddyAllocator::allocOrder(const size_t order) {
+    if (order > MAX_ORDER) {
+      return NO_PAGE;
+    }
+    LockGuard guard(lock);
+    const auto candidates = nonEmptyOrders & ~((1u << order) - 1);
+    if (candidates == 0) {
+      return NO_PAGE;
+    }
+    auto current = static_cast<size_t>(__builtin_ctz(candidates));
+    const uint64_t index = freeLists[current];
+    remove(index, current);
+    while (current > order) {
+      current--;
+      push(index + (static_cast<uint64_t>(1) << current), current);
+    }
+    state[index] = STATE_ALLOCATED | order;
+    links[index].next = 0;
+    freePageCount -= static_cast<size_t>(1) << order;
+    return base + index * PAGE_SIZE;
+  }
+
+  uint64_t BuddyAllocator::allocatedIndex(const uint64_t physical) const {
+    if (physical < base || physical % PAGE_SIZE != 0) {
+      return pageCount;
+    }
+    const auto index = (physical - base) / PAGE_SIZE;
+    if (index >= pageCount || (state[index] & STATE_ALLOCATED) == 0) {
+      return pageCount;
+    }
+    return index;
+  }
+
+  void BuddyAllocator::free(const uint64_t physical) {
+    LockGuard guard(lock);
+    const auto index = allocatedIndex(physical);
+    if (index == pageCount) {
+      return;
+    }
+    if (links[index].next > 0) {
+      links[index].next--;
+      return;
+    }
+    freeBlock(index, state[index] & STATE_ORDER_MASK);
+  }
+
+  bool BuddyAllocator::share(const uint64_t physical) {
+    LockGuard guard(lock);
+    const auto index = allocatedIndex(physical);
+    if (index == pageCount) {
+      return false;
+    }
+    links[index].next++;
+    return true;
+  }
+
+  uint32_t BuddyAllocator::countShares(const uint64_t physical) {
+    LockGuard guard(lock);
+    const auto index = allocatedIndex(physical);
+    return index == pageCount ? 0 : links[index].next;
+  }
+
+  size_t BuddyAllocator::countFreeBlocks(const size_t order) const {
+    size_t count = 0;
+    for (auto i = freeLists[order]; i != NIL; i = links[i].next) {
+      count++;
+    }
+    return count;
+  }
+
+  void BuddyAllocator::writeStats(const StatsFormatter &out) const {
+    out.value("total_pages", totalPageCount);
+    out.value("free_pages", freePageCount);
+    for (size_t order = 0; order <= MAX_ORDER; order++) {
+      if (nonEmptyOrders & (1u << order)) {
+        out.value("free_blocks", order, countFreeBlocks(order));
+      }
+    }
+  }
+} // namespace memory
@@ -0,0 +1,89 @@
+#ifndef BUDDYALLOCATOR_H
+#define BUDDYALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include "utils/spinlock.h"
+
+class StatsFormatter;
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+
+namespace memory {
+  // Physical page frame allocator. Blocks of 2^order pages are kept on per-order free lists and are naturally aligned
+  // to their size in physical memory, so order 9 hands out 2 MiB aligned runs and order 18 1 GiB aligned runs.
+  // All bookkeeping lives in a separate metadata area so free frames are never touched.
+  class BuddyAllocator {
+  public:
+    static constexpr size_t MAX_ORDER = 18;
+    static constexpr size_t ORDER_2M = 9;
+    static constexpr size_t ORDER_1G = 18;
+    static constexpr uint64_t NO_PAGE = ~0ull;
+
+    BuddyAllocator() = default;
+
+    [[nodiscard]] static size_t metadataSize(uint64_t physicalStart, uint64_t physicalEnd);
+
+    // metadata must point to at least metadataSize(physicalStart, physicalEnd) bytes, all pages start out reserved
+    void init(uint64_t physicalStart, uint64_t physicalEnd, void *metadata, uint64_t virtualOffset);
+
+    // hand a range of usable memory to the allocator, partial pages at either end are ignored
+    void addRange(uint64_t physical, uint64_t length);
+
+    // returns the physical address of a 2^order page block or NO_PAGE
+    [[nodiscard]] uint64_t allocOrder(size_t order);
+    [[nodiscard]] uint64_t alloc(size_t pages) { return allocOrder(orderFor(pages)); }
+    // drops one reference, the block goes back to the free lists once nothing shares it anymore
+    void free(uint64_t physical);
+
+    // adds a reference to an allocated block, returns false if physical is not the start of one
+    bool share(uint64_t physical);
+    // references held besides the one the block was allocated with
+    [[nodiscard]] uint32_t countShares(uint64_t physical);
+
+    [[nodiscard]] static size_t orderFor(size_t pages);
+
+    [[nodiscard]] void *toVirtual(const uint64_t physical) const {
+      return reinterpret_cast<void *>(physical + virtualOffset);
+    }
+    [[nodiscard]] uint64_t toPhysical(const void *ptr) const {
+      return reinterpret_cast<uint64_t>(ptr) - virtualOffset;
+    }
+
+    [[nodiscard]] size_t freePages() const { return freePageCount; }
+    [[nodiscard]] size_t totalPages() const { return totalPageCount; }
+    [[nodiscard]] size_t countFreeBlocks(size_t order) const;
+
+    void writeStats(const StatsFormatter &out) const;
+
+  protected:
+    // the link of an allocated block's first page is unused, so next holds the block's share count instead
+    struct Link {
+      uint32_t next;
+      uint32_t prev;
+    };
+
+    void freeBlock(uint64_t index, size_t order);
+    // returns pageCount if physical is not the start of an allocated block
+    [[nodiscard]] uint64_t allocatedIndex(uint64_t physical) const;
+    void push(uint64_t index, size_t order);
+    void remove(uint64_t index, size_t order);
+
+    uint64_t base = 0;
+    uint64_t pageCount = 0;
+    uint64_t virtualOffset = 0;
+    Link *links = nullptr;
+    uint8_t *state = nullptr;
+    uint32_t freeLists[MAX_ORDER + 1] = {};
+    uint32_t nonEmptyOrders = 0;
+    size_t freePageCount = 0;
+    size_t totalPageCount = 0;
+    Spinlock lock;
+  };
+
+  extern BuddyAllocator frameAllocator;
+} // namespace memory
+
+#endif // BUDDYALLOCATOR_H
@@ -0,0 +1,79 @@
+#include "EarlyArena.h"
+#include <limine.h>
+#include <memutil.h>
+#include "BuddyAllocator.h"
+#include "utils/panic.h"
+
+namespace memory {
+  EarlyArena earlyArena;
+
+  void EarlyArena::init(const size_t count, limine_memmap_entry **entries, const uint64_t hhdmOffset) {
+    this->entries = entries;
+    entryCount = count;
+    entryIndex = 0;
+    this->hhdmOffset = hhdmOffset;
+    cursor = 0;
+    end = 0;
+    rangeCount = 0;
+    pageCount = 0;
+    closed = false;
+  }
+
+  bool EarlyArena::nextEntry(const uint64_t size) {
+    for (; entryIndex < entryCount; entryIndex++) {
+      const auto entry = entries[entryIndex];
+      if (entry->type != LIMINE_MEMMAP_USABLE) {
+        continue;
+      }
+      const auto base = (entry->base + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+      const auto entryEnd = (entry->base + entry->length) / PAGE_SIZE * PAGE_SIZE;
+      if (base >= entryEnd || entryEnd - base < size) {
+        continue;
+      }
+      if (rangeCount == MAX_RANGES) {
+        kpanic("early arena ran out of ranges");
+      }
+      ranges[rangeCount++] = {base, 0};
+      cursor = base;
+      end = entryEnd;
+      entryIndex++;
+      return true;
+    }
+    return false;
+  }
+
+  void *EarlyArena::alloc(const size_t count) {
+    kassert(entries != nullptr && !closed);
+    const auto size = count * PAGE_SIZE;
+    if ((rangeCount == 0 || end - cursor < size) && !nextEntry(size)) {
+      kpanicf("early arena has no usable entry with %lu free pages", count);
+    }
+    const auto physical = cursor;
+    cursor += size;
+    ranges[rangeCount - 1].used = cursor - ranges[rangeCount - 1].base;
+    pageCount += count;
+    return toPtr(physical + hhdmOffset);
+  }
+
+  void EarlyArena::handOver(BuddyAllocator &frames) {
+    kassert(!closed);
+    closed = true;
+    for (size_t i = 0; i < entryCount; i++) {
+      const auto entry = entries[i];
+      if (entry->type != LIMINE_MEMMAP_USABLE) {
+        continue;
+      }
+      auto base = entry->base;
+      auto length = entry->length;
+      for (size_t r = 0; r < rangeCount; r++) {
+        if (ranges[r].base >= base && ranges[r].base < base + length) {
+          // ranges always start at the (page aligned) start of their entry
+          const auto skip = ranges[r].base + ranges[r].used - base;
+          base += skip;
+          length -= skip;
+        }
+      }
+      frames.addRange(base, length);
+    }
+  }
+} // namespace memory
@@ -0,0 +1,54 @@
+#ifndef EARLYARENA_H
+#define EARLYARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct limine_memmap_entry;
+
+namespace memory {
+  class BuddyAllocator;
+
+  // Bump allocator over the usable entries of the boot memory map, used for page tables and allocator metadata
+  // before the frame allocator exists. It walks forward through the usable entries as they fill up, so the only limit
+  // is the amount of usable memory. Once the frame allocator is up handOver gives it every page the arena did not use.
+  class EarlyArena {
+  public:
+    static constexpr size_t MAX_RANGES = 16;
+
+    void init(size_t count, limine_memmap_entry **entries, uint64_t hhdmOffset);
+
+    // returns the hhdm address of count contiguous pages, panics if no usable entry has room
+    [[nodiscard]] void *alloc(size_t count);
+
+    // add all usable memory except what the arena handed out to the frame allocator, the arena is closed afterwards
+    void handOver(BuddyAllocator &frames);
+
+    [[nodiscard]] size_t usedPages() const { return pageCount; }
+    [[nodiscard]] bool isClosed() const { return closed; }
+
+  protected:
+    struct Range {
+      uint64_t base;
+      uint64_t used;
+    };
+
+    [[nodiscard]] bool nextEntry(uint64_t size);
+
+    limine_memmap_entry **entries = nullptr;
+    size_t entryCount = 0;
+    size_t entryIndex = 0;
+    uint64_t hhdmOffset = 0;
+    uint64_t cursor = 0;
+    uint64_t end = 0;
+    // the used prefix of every entry the arena has allocated from
+    Range ranges[MAX_RANGES] = {};
+    size_t rangeCount = 0;
+    size_t pageCount = 0;
+    bool closed = false;
+  };
+
+  extern EarlyArena earlyArena;
+} // namespace memory
+
+#endif // EARLYARENA_H
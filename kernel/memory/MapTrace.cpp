@@ -0,0 +1,17 @@
+#include "MapTrace.h"
+#include <cstdio>
+
+namespace memory {
+  void MapTrace::dump(const statsWriter_t write) const {
+    static constexpr const char *OP_NAMES[] = {"map", "unmap", "hhdm"};
+    const auto first = recorded - count();
+    for (size_t i = 0; i < count(); i++) {
+      const auto &entry = at(i);
+      char buf[128];
+      const auto n = ksnprintf(buf, sizeof(buf), "trace.%lu=%s %lx %lx %lx %lx\n", first + i,
+                               OP_NAMES[static_cast<int>(entry.op)], entry.virtualAddress, entry.physicalAddress,
+                               entry.size, entry.flags);
+      write(buf, n < static_cast<int>(sizeof(buf)) ? n : sizeof(buf) - 1);
+    }
+  }
+} // namespace memory
@@ -0,0 +1,50 @@
+#ifndef MAPTRACE_H
+#define MAPTRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include "AllocatorStats.h"
+
+namespace memory {
+  // Ring of the most recent page table operations. Recording is a handful of stores, so it stays on while mapping
+  // large ranges, and the ring is dumped on request instead of logging every call to the console.
+  class MapTrace {
+  public:
+    static constexpr size_t CAPACITY = 128;
+
+    enum class Op : uint8_t { MAP, UNMAP, HHDM };
+
+    struct Entry {
+      uint64_t virtualAddress;
+      uint64_t physicalAddress;
+      uint64_t size;
+      uint64_t flags;
+      Op op;
+    };
+
+    void record(const Op op, const uint64_t virtualAddress, const uint64_t physicalAddress, const uint64_t size,
+                const uint64_t flags) {
+      if (enabled) {
+        entries[recorded % CAPACITY] = {virtualAddress, physicalAddress, size, flags, op};
+        recorded++;
+      }
+    }
+
+    void setEnabled(const bool enable) { enabled = enable; }
+
+    [[nodiscard]] size_t count() const { return recorded < CAPACITY ? recorded : CAPACITY; }
+    [[nodiscard]] uint64_t countRecorded() const { return recorded; }
+    // index 0 is the oldest entry still in the ring
+    [[nodiscard]] const Entry &at(const size_t index) const { return entries[(recorded - count() + index) % CAPACITY]; }
+
+    // one "trace.<n>=<op> <virtual> <physical> <size> <flags>" line per entry, oldest first
+    void dump(statsWriter_t write) const;
+
+  protected:
+    Entry entries[CAPACITY] = {};
+    uint64_t recorded = 0;
+    bool enabled = true;
+  };
+} // namespace memory
+
+#endif // MAPTRACE_H
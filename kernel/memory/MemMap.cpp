@@ -3,8 +3,11 @@
 #include <framebuffer/VirtualConsole.h>
 #include <limine.h>
 #include <memutil.h>
+#include "BuddyAllocator.h"
+#include "EarlyArena.h"
 #include "memory/paging.h"
 #include "utils/bytes.h"
+#include "utils/panic.h"
 
 namespace memory {
   __attribute__((used, section(".limine_requests"))) volatile limine_memmap_request memMapRequest = {
@@ -61,7 +64,44 @@ namespace memory {
         kprintf("%s: %s\n", getMemMapTypeDescription(i), bytesToHumanReadable(buf, sizeof(buf), perTypeMemory[i]));
       }
     }
+    earlyArena.init(memMapRequest.response->entry_count, memMapRequest.response->entries,
+                    hhdm_request.response->offset);
     paging.init(memMapRequest.response->entry_count, memMapRequest.response->entries, hhdm_request.response->offset,
                 kernel_address.response->virtual_base - kernel_address.response->physical_base);
+    initFrameAllocator(hhdm_request.response->offset);
+  }
+
+  void MemMap::initFrameAllocator(const uint64_t hhdmOffset) {
+    const auto count = memMapRequest.response->entry_count;
+    const auto entries = memMapRequest.response->entries;
+    uint64_t start = ~0ull;
+    uint64_t end = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (entries[i]->type == LIMINE_MEMMAP_USABLE) {
+        if (entries[i]->base < start) {
+          start = entries[i]->base;
+        }
+        if (entries[i]->base + entries[i]->length > end) {
+          end = entries[i]->base + entries[i]->length;
+        }
+      }
+    }
+    if (end == 0) {
+      kpanic("no usable memory");
+    }
+    const auto metadataPages = (BuddyAllocator::metadataSize(start, end) + PAGE_SIZE - 1) / PAGE_SIZE;
+    const auto metadata = earlyArena.alloc(metadataPages);
+    // the fault handler allocates frames, so the allocator must never fault on its own metadata
+    paging.mapHhdmRange(reinterpret_cast<uint64_t>(metadata) - hhdmOffset, metadataPages * PAGE_SIZE);
+    frameAllocator.init(start, end, metadata, hhdmOffset);
+    const auto arenaPages = earlyArena.usedPages();
+    earlyArena.handOver(frameAllocator);
+    // the arena is closed now, page tables for later faults come from frames
+    Paging::useTablePool();
+    char freeBuf[32];
+    char arenaBuf[32];
+    kprintf("frame allocator: %s free, %s used during early boot, metadata at %p\n",
+            bytesToHumanReadable(freeBuf, sizeof(freeBuf), frameAllocator.freePages() * PAGE_SIZE),
+            bytesToHumanReadable(arenaBuf, sizeof(arenaBuf), arenaPages * PAGE_SIZE), metadata);
   }
 } // namespace memory
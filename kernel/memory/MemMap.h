@@ -4,18 +4,12 @@
 #include <cstdint>
 
 namespace memory {
-  struct UsableMemory {
-    uint64_t base;
-    uint64_t length;
-    uint8_t pageAllocated[1];
-  };
-
   class MemMap {
   public:
     void init();
 
   protected:
-    // UsableMemory *usableMemory[];
+    void initFrameAllocator(uint64_t hhdmOffset);
   };
 
   extern MemMap memMap;
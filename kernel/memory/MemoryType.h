@@ -0,0 +1,20 @@
+#ifndef MEMORYTYPE_H
+#define MEMORYTYPE_H
+
+#include <cstdint>
+
+namespace memory {
+  // cache behaviour of a mapping, each architecture programs one attribute slot per type
+  enum class MemoryType : uint8_t {
+    // write back, for ordinary memory
+    WB,
+    // write combining, for framebuffers and other write only streams
+    WC,
+    // uncached, for MMIO
+    UC,
+    // write through
+    WT,
+  };
+} // namespace memory
+
+#endif // MEMORYTYPE_H
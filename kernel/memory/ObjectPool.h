@@ -0,0 +1,90 @@
+#ifndef OBJECTPOOL_H
+#define OBJECTPOOL_H
+
+#include <cstddef>
+#include <new>
+#include "memalloc.h"
+
+// Fixed-size pool for objects of one type. Objects are carved back to back out of whole pages with no per object
+// header, and freed objects are chained through their own storage so alloc and free are a pointer swap. Pages are
+// kept by the pool for reuse and never handed back.
+template<typename T>
+class ObjectPool {
+public:
+  static_assert(alignof(T) <= PAGE_SIZE);
+  static constexpr size_t OBJECT_ALIGN = alignof(T) > alignof(void *) ? alignof(T) : alignof(void *);
+  static constexpr size_t OBJECT_SIZE =
+      ((sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *)) + OBJECT_ALIGN - 1) & ~(OBJECT_ALIGN - 1);
+  static_assert(OBJECT_SIZE <= PAGE_SIZE);
+
+  ObjectPool() = default;
+
+  [[nodiscard]] explicit ObjectPool(const getPage_t get_page, const size_t chunk_pages = 1) :
+      getPage(get_page), chunkPages(chunk_pages) {}
+
+  // uninitialised storage for one T, nullptr if no page could be allocated
+  [[nodiscard]] void *alloc() {
+    void *ptr;
+    if (freeList != nullptr) {
+      ptr = freeList;
+      freeList = freeList->next;
+    } else {
+      if (next == end) {
+        const auto chunk = static_cast<char *>(getPage(chunkPages));
+        if (chunk == nullptr) {
+          return nullptr;
+        }
+        next = chunk;
+        end = chunk + chunkPages * PAGE_SIZE / OBJECT_SIZE * OBJECT_SIZE;
+        pageCount += chunkPages;
+      }
+      ptr = next;
+      next += OBJECT_SIZE;
+    }
+    allocCount++;
+    return ptr;
+  }
+
+  void free(void *ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+    const auto node = static_cast<FreeNode *>(ptr);
+    node->next = freeList;
+    freeList = node;
+    freeCount++;
+  }
+
+  template<typename... Args>
+  [[nodiscard]] T *create(Args &&...args) {
+    const auto ptr = alloc();
+    return ptr != nullptr ? new (ptr) T(static_cast<Args &&>(args)...) : nullptr;
+  }
+
+  void destroy(T *object) {
+    if (object != nullptr) {
+      object->~T();
+      free(object);
+    }
+  }
+
+  [[nodiscard]] size_t countAlloc() const { return allocCount; }
+  [[nodiscard]] size_t countFree() const { return freeCount; }
+  [[nodiscard]] size_t countPages() const { return pageCount; }
+
+protected:
+  struct FreeNode {
+    FreeNode *next;
+  };
+
+  getPage_t getPage = ::getPage;
+  size_t chunkPages = 1;
+  FreeNode *freeList = nullptr;
+  char *next = nullptr;
+  char *end = nullptr;
+  size_t allocCount = 0;
+  size_t freeCount = 0;
+  size_t pageCount = 0;
+};
+
+#endif // OBJECTPOOL_H
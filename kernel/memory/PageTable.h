@@ -0,0 +1,721 @@
+#ifndef PAGETABLE_H
+#define PAGETABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "memory/AsidAllocator.h"
+#include "memory/BuddyAllocator.h"
+#include "memory/MapTrace.h"
+#include "memory/MemoryType.h"
+#include "memory/TlbBatch.h"
+#include "utils/panic.h"
+
+namespace memory {
+  // Page table engine shared by every architecture. Arch is a constexpr descriptor that supplies the table layout
+  // (levels, granule and index bits, so far only four levels of 4 KiB tables), the entry encoding (present, table and
+  // leaf bits, write permission, global pages, memory types, copy on write bits) and whether the kernel half has a
+  // root of its own. Everything touching the cpu directly (tlb maintenance, loading the tables, reading what the
+  // bootloader left behind) stays with the architecture, so the engine also builds on the host.
+  template<typename Arch>
+  class PageTable {
+  public:
+    static constexpr int LEVELS = Arch::LEVELS;
+    static constexpr size_t PAGE_ENTRIES = static_cast<size_t>(1) << Arch::INDEX_BITS;
+    static_assert(static_cast<uint64_t>(1) << Arch::PAGE_SHIFT == PAGE_SIZE, "the granule has to be PAGE_SIZE");
+    static_assert(PAGE_ENTRIES * sizeof(uint64_t) == PAGE_SIZE, "a table has to fill one page");
+    // mapPages keeps a cursor into the two levels above the last one and tells them apart by page size
+    static_assert(LEVELS == 4, "mapPages walks four levels");
+
+    // the lowest address bit of the index into a table of the given level, levels count from 1 at the root
+    static constexpr int indexShift(const int level) {
+      return Arch::PAGE_SHIFT + Arch::INDEX_BITS * (LEVELS - level);
+    }
+    // size covered by one entry of the given level
+    static constexpr uint64_t levelSize(const int level) { return static_cast<uint64_t>(1) << indexShift(level); }
+
+    // the sizes of a leaf one and two levels above the last
+    static constexpr uint64_t PAGE_SIZE_2M = static_cast<uint64_t>(1) << (Arch::PAGE_SHIFT + Arch::INDEX_BITS);
+    static constexpr uint64_t PAGE_SIZE_1G = PAGE_SIZE_2M << Arch::INDEX_BITS;
+
+    using getTable_t = void *(*)(size_t count);
+    using freeTable_t = void (*)(void *table);
+    // returns the memory map entry physical lies in if it may be mapped through the hhdm on demand
+    using lazyRange_t = bool (*)(uint64_t physical, uint64_t &base, uint64_t &length);
+
+    struct PageTableRangeData {
+      uint64_t virtualStart;
+      uint64_t virtualEnd;
+      uint64_t physicalStart;
+      uint64_t physicalEnd;
+      uint64_t flags;
+      uint64_t pageCount;
+      uint64_t pageSize;
+    };
+
+    struct PageTableLeaf {
+      uint64_t virtualAddress;
+      uint64_t physicalAddress;
+      uint64_t flags;
+      uint64_t pageSize;
+    };
+
+    // Visits the present leaves of one table tree in address order. A not present entry is stepped over together
+    // with everything below it, so a walk costs the number of present entries and not the size of the address space.
+    // virtualBase is added to every address, for trees that only cover the kernel half.
+    template<typename MapTable>
+    class LeafIterator {
+    public:
+      LeafIterator(const uint64_t *root, const uint64_t virtual_base, MapTable map_table) :
+          mapTable(map_table), virtualBase(virtual_base) {
+        tables[0] = root;
+      }
+
+      bool next(PageTableLeaf &leaf) {
+        while (depth >= 0) {
+          if (index[depth] == PAGE_ENTRIES) {
+            if (--depth >= 0) {
+              index[depth]++;
+            }
+            continue;
+          }
+          const auto entry = tables[depth][index[depth]];
+          const auto level = depth + 1;
+          if (!(entry & Arch::PRESENT)) {
+            index[depth]++;
+            continue;
+          }
+          if (Arch::isTable(entry, level)) {
+            tables[depth + 1] = mapTable(entry & Arch::ADDRESS_MASK);
+            index[++depth] = 0;
+            continue;
+          }
+          if (level == 1) {
+            kpanic("unsupported huge page");
+          }
+          uint64_t address = 0;
+          for (int i = 0; i <= depth; i++) {
+            address |= index[i] << indexShift(i + 1);
+          }
+          leaf = {Arch::canonical(virtualBase + address), entry & Arch::ADDRESS_MASK & ~(levelSize(level) - 1),
+                  Arch::leafFlags(entry, level), levelSize(level)};
+          index[depth]++;
+          return true;
+        }
+        return false;
+      }
+
+    private:
+      MapTable mapTable;
+      uint64_t virtualBase;
+      const uint64_t *tables[LEVELS] = {};
+      uint64_t index[LEVELS] = {};
+      int depth = 0;
+    };
+
+    // Merges leaves that continue each other both virtually and physically with the same flags and page size.
+    template<typename MapTable>
+    class RangeIterator {
+    public:
+      RangeIterator(const uint64_t *root, const uint64_t virtual_base, MapTable map_table) :
+          leaves(root, virtual_base, map_table) {
+        pending = leaves.next(leaf);
+      }
+
+      bool next(PageTableRangeData &range) {
+        if (!pending) {
+          return false;
+        }
+        range = {leaf.virtualAddress, leaf.virtualAddress + leaf.pageSize - 1,
+                 leaf.physicalAddress, leaf.physicalAddress + leaf.pageSize - 1,
+                 leaf.flags & ~Arch::HARDWARE_FLAGS, 1, leaf.pageSize};
+        while ((pending = leaves.next(leaf))) {
+          if (leaf.virtualAddress != range.virtualEnd + 1 || leaf.physicalAddress != range.physicalEnd + 1 ||
+              (leaf.flags & ~Arch::HARDWARE_FLAGS) != range.flags || leaf.pageSize != range.pageSize) {
+            break;
+          }
+          range.virtualEnd += leaf.pageSize;
+          range.physicalEnd += leaf.pageSize;
+          range.pageCount++;
+        }
+        return true;
+      }
+
+    private:
+      LeafIterator<MapTable> leaves;
+      PageTableLeaf leaf = {};
+      bool pending = false;
+    };
+
+    [[nodiscard]] explicit PageTable(const TlbBatch::invalidatePage_t invalidate_page,
+                                     const TlbBatch::invalidateAll_t invalidate_all,
+                                     const TlbBatch::sync_t sync = nullptr) :
+        tlb(invalidate_page, invalidate_all, sync), sync(sync) {}
+
+    // map a physical address to a virtual address that doesn't have to be page aligned
+    void mapPartial(uint64_t physical_address, uint64_t virtual_address, size_t size, uint64_t flags);
+
+    void mapMemory(uint64_t physical_address, uint64_t virtual_address, size_t pageSize, size_t num_pages,
+                   uint64_t flags);
+
+    // the cache attributes in flags are replaced by those selecting type
+    void mapMemory(const uint64_t physical_address, const uint64_t virtual_address, const size_t pageSize,
+                   const size_t num_pages, const uint64_t flags, const MemoryType type) {
+      mapMemory(physical_address, virtual_address, pageSize, num_pages,
+                (flags & ~Arch::MEMORY_TYPE_MASK) | Arch::memoryTypeFlags(type));
+    }
+
+    // removes leaves of exactly pageSize, a page covered by a larger leaf is left alone. Tables left empty are
+    // unlinked and handed back to freeTable once the tlb no longer references them.
+    void unmapMemory(uint64_t virtual_address, size_t num_pages, size_t pageSize);
+
+    // maps the hhdm page backing a not present kernel access, returns false if the address is not lazily mapped
+    bool handleFault(uint64_t virtualAddress);
+
+    // maps a range of the hhdm up front, for memory touched while holding locks the fault handler needs
+    void mapHhdmRange(uint64_t physical, size_t size);
+
+    // sets this up as an address space with an empty user half that shares the kernel half of kernel, which has to
+    // outlive it
+    void createFrom(PageTable &kernel);
+
+    // fork style copy of parent's user half. Pages marked Arch::OWNED are shared read only and copied on the first
+    // write from either side, all other pages stay shared as they are.
+    void forkFrom(PageTable &parent);
+
+    // frees the user half tables and drops the references to owned pages
+    void destroy();
+
+    // gives the writer its own copy of a copy on write page, returns false if the page is not copy on write
+    bool handleWriteFault(uint64_t virtualAddress);
+
+    // the leaf entry for virtualAddress or the first not present entry on the way to it
+    uint64_t *lookup(uint64_t virtualAddress, int &level) const;
+    // the same, tables[i] is set to the table walked at level i + 1
+    uint64_t *lookup(uint64_t virtualAddress, int &level, uint64_t **tables) const;
+
+    [[nodiscard]] uint64_t countFaults() const { return faultCount; }
+    [[nodiscard]] uint64_t faultMappedSize() const { return faultMappedBytes; }
+    [[nodiscard]] uint64_t countReclaimedTables() const { return reclaimedTables; }
+
+    // map and unmap calls between beginBatch and endBatch share one tlb flush
+    void beginBatch() { tlb.begin(); }
+    void endBatch() {
+      tlb.end();
+      releasePendingTables();
+    }
+    [[nodiscard]] TlbBatch &tlbBatch() { return tlb; }
+    [[nodiscard]] MapTrace &mapTrace() { return trace; }
+
+    [[nodiscard]] static const AsidAllocator &asidAllocator() { return asids; }
+    // the address space faults are resolved against
+    [[nodiscard]] static PageTable &activeSpace() { return *active; }
+
+    static void setTableAllocator(const getTable_t get, const freeTable_t free) {
+      getTable = get;
+      freeTable = free;
+    }
+    static void setLazyRange(const lazyRange_t lazy_range) { lazyRange = lazy_range; }
+
+    [[nodiscard]] static uint64_t makePageAligned(const uint64_t address) { return address & ~0xFFFull; }
+
+  protected:
+    // bounds the recursion of page tables mapping the hhdm pages of other page tables, directly or through faults
+    static constexpr int MAX_TABLE_DEPTH = 8;
+
+    static inline getTable_t getTable = nullptr;
+    static inline freeTable_t freeTable = nullptr;
+    static inline lazyRange_t lazyRange = nullptr;
+    // shared by every address space, a single id until the architecture sets up more
+    static inline AsidAllocator asids;
+    static inline PageTable *active = nullptr;
+
+    // with a separate kernel root, roots[1] covers everything from kernelHalf up
+    uint64_t *roots[Arch::ROOTS] = {};
+    uint64_t hhdmOffset = 0;
+    uint64_t kernelHalf = Arch::KERNEL_HALF;
+    // flags of the hhdm mapping the bootloader created, reused for pages mapped on demand
+    uint64_t hhdmFlags = Arch::HHDM_FLAGS;
+    bool gigaPages = true;
+    int tableDepth = 0;
+    uint64_t faultCount = 0;
+    uint64_t faultMappedBytes = 0;
+    uint64_t reclaimedTables = 0;
+    // unlinked tables waiting for the flush that drops them from the paging structure caches, chained through
+    // their first entry
+    uint64_t *pendingTables = nullptr;
+    MapTrace trace;
+    TlbBatch tlb;
+    // makes table writes visible to the walker, nullptr where stores already are
+    TlbBatch::sync_t sync = nullptr;
+    AsidAllocator::Asid asid;
+    // the address space the kernel half comes from, nullptr for the kernel itself
+    PageTable *kernelSpace = nullptr;
+    // address spaces created from this one, new kernel half root entries are copied into all of them
+    PageTable *spaces = nullptr;
+    PageTable *nextSpace = nullptr;
+
+    [[nodiscard]] uint64_t *rootFor(const uint64_t virtualAddress) const {
+      return roots[Arch::ROOTS > 1 && virtualAddress >= kernelHalf ? Arch::ROOTS - 1 : 0];
+    }
+
+    [[nodiscard]] uint64_t *tableAt(const uint64_t entry) const {
+      return reinterpret_cast<uint64_t *>((entry & Arch::ADDRESS_MASK) + hhdmOffset);
+    }
+
+    [[nodiscard]] uint64_t tablePhysical(const uint64_t *table) const {
+      return reinterpret_cast<uint64_t>(table) - hhdmOffset;
+    }
+
+    static uint16_t indexAt(const uint64_t virtualAddress, const int level) {
+      return virtualAddress >> indexShift(level) & (PAGE_ENTRIES - 1);
+    }
+
+    void mapPages(uint64_t physical_address, uint64_t virtual_address, size_t pageSize, size_t num_pages,
+                  uint64_t flags);
+
+    uint64_t *nextTable(uint64_t *table, uint16_t index);
+
+    uint64_t *allocTable();
+
+    // returns the size of the page that was mapped, 0 if the address was already mapped
+    size_t mapHhdm(uint64_t physical);
+
+    // frees a table with everything below it, only the first count entries are visited
+    void releaseTables(uint64_t *table, int level, size_t count = PAGE_ENTRIES);
+
+    void shareRootEntry(uint16_t index);
+
+    // unlinks the tables on the path to virtualAddress that no longer map anything, bottom up from level
+    void reclaimTables(uint64_t **tables, uint64_t virtualAddress, int level);
+    // frees the tables reclaimTables queued, once the batch that unlinked them has been flushed
+    void releasePendingTables();
+
+    static void setPageTableEntry(uint64_t *table, uint16_t index, int level, uint64_t virtualAddress,
+                                  uint64_t physicalAddress, uint64_t flags);
+  };
+
+  template<typename Arch>
+  void PageTable<Arch>::mapPartial(const uint64_t physical_address, const uint64_t virtual_address, const size_t size,
+                                   const uint64_t flags) {
+    const auto new_physical_address = makePageAligned(physical_address);
+    const auto new_virtual_address = makePageAligned(virtual_address);
+    auto new_size = size + PAGE_SIZE - (size % PAGE_SIZE);
+    if (physical_address + size > new_physical_address + new_size) {
+      new_size += PAGE_SIZE;
+    }
+    mapMemory(new_physical_address, new_virtual_address, PAGE_SIZE, new_size / PAGE_SIZE, flags);
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::mapMemory(const uint64_t physical_address, const uint64_t virtual_address,
+                                  const size_t pageSize, const size_t num_pages, const uint64_t flags) {
+    if (physical_address % PAGE_SIZE != 0) {
+      kpanic("physical address must be page aligned");
+    }
+    if (virtual_address % PAGE_SIZE != 0) {
+      kpanicf("virtual address %lx is not page aligned", virtual_address);
+    }
+    if (kernelSpace != nullptr && virtual_address + num_pages * pageSize > kernelHalf) {
+      kpanic("the kernel half is mapped through the kernel address space");
+    }
+    trace.record(MapTrace::Op::MAP, virtual_address, physical_address, num_pages * pageSize, flags);
+    mapPages(physical_address, virtual_address, pageSize, num_pages, flags);
+    // new entries only ever replace not present ones, which the tlb never caches
+    if (sync != nullptr) {
+      sync();
+    }
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::mapPages(uint64_t physical_address, uint64_t virtual_address, const size_t pageSize,
+                                 const size_t num_pages, const uint64_t flags) {
+    // every step uses the largest page the alignment of both addresses, the remaining length and the existing
+    // tables allow
+    const auto end = virtual_address + pageSize * num_pages;
+    // the kernel half is the same in every address space, so it does not have to be flushed on a switch
+    const auto leafFlags = Arch::globalFlags(flags, virtual_address >= kernelHalf);
+    const auto fits = [&](const uint64_t size) {
+      return virtual_address % size == 0 && physical_address % size == 0 && end - virtual_address >= size;
+    };
+    // a page that is already covered by a larger leaf is left alone
+    const auto skipTo = [&](const uint64_t size) {
+      const auto next = (virtual_address & ~(size - 1)) + size;
+      const auto step = (next < end ? next : end) - virtual_address;
+      virtual_address += step;
+      physical_address += step;
+    };
+    // the page directory and page table of the last step are kept, so only crossing a 2 MiB or 1 GiB boundary
+    // walks down from the root again. Tables are never freed while mapping, so the cached pointers stay valid even
+    // when mapping a new table's hhdm page recurses into here.
+    uint64_t *pd = nullptr;
+    uint64_t *pt = nullptr;
+    auto pdBase = ~0ull;
+    auto ptBase = ~0ull;
+    while (virtual_address < end) {
+      if ((virtual_address & ~(PAGE_SIZE_2M - 1)) != ptBase) {
+        if ((virtual_address & ~(PAGE_SIZE_1G - 1)) != pdBase) {
+          const auto root = rootFor(virtual_address);
+          const auto l1 = indexAt(virtual_address, 1);
+          const auto rootEntry = root[l1];
+          const auto pdpt = nextTable(root, l1);
+          if (root[l1] != rootEntry) {
+            shareRootEntry(l1);
+          }
+          const auto l2 = indexAt(virtual_address, 2);
+          if (!(pdpt[l2] & Arch::PRESENT) && gigaPages && fits(PAGE_SIZE_1G)) {
+            setPageTableEntry(pdpt, l2, 2, virtual_address, physical_address, leafFlags);
+            virtual_address += PAGE_SIZE_1G;
+            physical_address += PAGE_SIZE_1G;
+            continue;
+          }
+          if ((pdpt[l2] & Arch::PRESENT) && !Arch::isTable(pdpt[l2], 2)) {
+            skipTo(PAGE_SIZE_1G);
+            continue;
+          }
+          pd = nextTable(pdpt, l2);
+          pdBase = virtual_address & ~(PAGE_SIZE_1G - 1);
+        }
+        const auto l3 = indexAt(virtual_address, 3);
+        if (!(pd[l3] & Arch::PRESENT) && fits(PAGE_SIZE_2M)) {
+          setPageTableEntry(pd, l3, 3, virtual_address, physical_address, leafFlags);
+          virtual_address += PAGE_SIZE_2M;
+          physical_address += PAGE_SIZE_2M;
+          continue;
+        }
+        if ((pd[l3] & Arch::PRESENT) && !Arch::isTable(pd[l3], 3)) {
+          skipTo(PAGE_SIZE_2M);
+          continue;
+        }
+        pt = nextTable(pd, l3);
+        ptBase = virtual_address & ~(PAGE_SIZE_2M - 1);
+      }
+      setPageTableEntry(pt, indexAt(virtual_address, LEVELS), LEVELS, virtual_address, physical_address, leafFlags);
+      physical_address += PAGE_SIZE;
+      virtual_address += PAGE_SIZE;
+    }
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::unmapMemory(uint64_t virtual_address, const size_t num_pages, const size_t pageSize) {
+    if (virtual_address % PAGE_SIZE != 0) {
+      kpanicf("virtual address %lx is not page aligned", virtual_address);
+    }
+    trace.record(MapTrace::Op::UNMAP, virtual_address, 0, num_pages * pageSize, 0);
+    tlb.begin();
+    for (size_t i = 0; i < num_pages; ++i, virtual_address += pageSize) {
+      int level;
+      uint64_t *tables[LEVELS];
+      const auto entry = lookup(virtual_address, level, tables);
+      if ((*entry & Arch::PRESENT) && levelSize(level) <= pageSize) {
+        kassertf(levelSize(level) == pageSize, "page at %lx is smaller than %lx", virtual_address, pageSize);
+        *entry = 0;
+        tlb.add(virtual_address, pageSize);
+      }
+      // a table is only scanned once the range leaves it, not once per page
+      if (i + 1 == num_pages || indexAt(virtual_address + pageSize, level) == 0) {
+        reclaimTables(tables, virtual_address, level);
+      }
+    }
+    tlb.end();
+    releasePendingTables();
+    // as in forkFrom, the invalidations did not reach the id of an address space that is not active
+    if (!Arch::BROADCAST_INVALIDATION && this != active) {
+      asid = {};
+    }
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::reclaimTables(uint64_t **tables, const uint64_t virtualAddress, const int level) {
+    // without freeTable the tables come from the early arena and stay where they are
+    if (freeTable == nullptr) {
+      return;
+    }
+    // below a single root the kernel half root entries are copied into every address space, so the tables they
+    // point to have to stay
+    const auto lowest = Arch::ROOTS == 1 && virtualAddress >= kernelHalf ? 3 : 2;
+    for (auto current = level; current >= lowest; current--) {
+      const auto table = tables[current - 1];
+      for (size_t i = 0; i < PAGE_ENTRIES; i++) {
+        if (table[i] & Arch::PRESENT) {
+          return;
+        }
+      }
+      tables[current - 2][indexAt(virtualAddress, current - 1)] = 0;
+      // pointers are 8 byte aligned, so a walk still going through the cached table sees a not present entry
+      table[0] = reinterpret_cast<uint64_t>(pendingTables);
+      pendingTables = table;
+      if (Arch::BROADCAST_INVALIDATION) {
+        tlb.add(virtualAddress & ~(levelSize(current - 1) - 1), PAGE_SIZE);
+      } else {
+        // a page invalidation only reaches the current id, while every other address space sharing the path may
+        // still cache it
+        tlb.addAll();
+      }
+    }
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::releasePendingTables() {
+    if (tlb.inBatch()) {
+      return;
+    }
+    while (pendingTables != nullptr) {
+      const auto table = pendingTables;
+      pendingTables = reinterpret_cast<uint64_t *>(table[0]);
+      table[0] = 0;
+      freeTable(table);
+      reclaimedTables++;
+    }
+  }
+
+  template<typename Arch>
+  uint64_t *PageTable<Arch>::lookup(const uint64_t virtualAddress, int &level) const {
+    uint64_t *tables[LEVELS];
+    return lookup(virtualAddress, level, tables);
+  }
+
+  template<typename Arch>
+  uint64_t *PageTable<Arch>::lookup(const uint64_t virtualAddress, int &level, uint64_t **tables) const {
+    auto table = rootFor(virtualAddress);
+    for (level = 1;; level++) {
+      tables[level - 1] = table;
+      const auto entry = &table[indexAt(virtualAddress, level)];
+      if (!(*entry & Arch::PRESENT) || !Arch::isTable(*entry, level)) {
+        return entry;
+      }
+      table = tableAt(*entry);
+    }
+  }
+
+  template<typename Arch>
+  uint64_t *PageTable<Arch>::nextTable(uint64_t *table, const uint16_t index) {
+    if (!(table[index] & Arch::PRESENT)) {
+      // counted before the allocation: clearing the new table can fault on its hhdm page, and the fault handler
+      // comes back here for the tables of that mapping
+      if (++tableDepth > MAX_TABLE_DEPTH) {
+        kpanic("page table allocation does not converge");
+      }
+      const auto newTable = allocTable();
+      table[index] = Arch::makeTable(tablePhysical(newTable));
+      // Tables are written through the hhdm, so their own hhdm page has to be mapped as well. That only happens once
+      // the table is linked: its page often lies in the very range it is about to map, and mapping it first would
+      // ask for the same table again. Until then it is reached through the bootloader's tables during init and
+      // through a page the fault handler maps afterwards.
+      mapHhdm(tablePhysical(newTable));
+      tableDepth--;
+    }
+    return tableAt(table[index]);
+  }
+
+  template<typename Arch>
+  uint64_t *PageTable<Arch>::allocTable() {
+    const auto table = static_cast<uint64_t *>(getTable(1));
+    if (table == nullptr) {
+      kpanic("out of memory for page tables");
+    }
+    memset(table, 0, PAGE_SIZE);
+    return table;
+  }
+
+  template<typename Arch>
+  size_t PageTable<Arch>::mapHhdm(const uint64_t physical) {
+    if (kernelSpace != nullptr) {
+      return kernelSpace->mapHhdm(physical);
+    }
+    int level;
+    if (*lookup(physical + hhdmOffset, level) & Arch::PRESENT) {
+      return 0;
+    }
+    // the largest page that has nothing mapped below it yet and stays inside one memory map entry
+    uint64_t entryBase = 0;
+    uint64_t entryLength = 0;
+    const auto lazy = lazyRange != nullptr && lazyRange(physical, entryBase, entryLength);
+    auto pageSize = PAGE_SIZE;
+    constexpr uint64_t sizes[] = {PAGE_SIZE_1G, PAGE_SIZE_2M};
+    for (const auto size: sizes) {
+      const auto base = physical & ~(size - 1);
+      if (level <= (size == PAGE_SIZE_1G ? 2 : 3) && (size != PAGE_SIZE_1G || gigaPages) && lazy &&
+          base >= entryBase && base + size <= entryBase + entryLength) {
+        pageSize = size;
+        break;
+      }
+    }
+    const auto base = physical & ~(pageSize - 1);
+    trace.record(MapTrace::Op::HHDM, base + hhdmOffset, base, pageSize, hhdmFlags);
+    mapPages(base, base + hhdmOffset, pageSize, 1, hhdmFlags);
+    if (sync != nullptr) {
+      sync();
+    }
+    return pageSize;
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::mapHhdmRange(const uint64_t physical, const size_t size) {
+    for (auto page = makePageAligned(physical); page < physical + size; page += PAGE_SIZE) {
+      mapHhdm(page);
+    }
+  }
+
+  template<typename Arch>
+  bool PageTable<Arch>::handleFault(const uint64_t virtualAddress) {
+    uint64_t entryBase;
+    uint64_t entryLength;
+    if (virtualAddress < hhdmOffset || lazyRange == nullptr ||
+        !lazyRange(virtualAddress - hhdmOffset, entryBase, entryLength)) {
+      return false;
+    }
+    int level;
+    if (*lookup(virtualAddress, level) & Arch::PRESENT) {
+      return false;
+    }
+    faultMappedBytes += mapHhdm(virtualAddress - hhdmOffset);
+    faultCount++;
+    return true;
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::createFrom(PageTable &kernel) {
+    kassert(kernel.kernelSpace == nullptr);
+    hhdmOffset = kernel.hhdmOffset;
+    kernelHalf = kernel.kernelHalf;
+    hhdmFlags = kernel.hhdmFlags;
+    gigaPages = kernel.gigaPages;
+    kernelSpace = &kernel;
+    roots[0] = allocTable();
+    mapHhdm(tablePhysical(roots[0]));
+    if constexpr (Arch::ROOTS > 1) {
+      // the kernel half has its own root, so sharing it is sharing the table
+      roots[Arch::ROOTS - 1] = kernel.roots[Arch::ROOTS - 1];
+    } else {
+      // the kernel half root entries point at the same tables, so everything mapped below them is shared
+      for (auto i = indexAt(kernelHalf, 1); i < PAGE_ENTRIES; i++) {
+        roots[0][i] = kernel.roots[0][i];
+      }
+      nextSpace = kernel.spaces;
+      kernel.spaces = this;
+    }
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::forkFrom(PageTable &parent) {
+    createFrom(parent.kernelSpace != nullptr ? *parent.kernelSpace : parent);
+    const auto mapTable = [this](const uint64_t physical) {
+      return reinterpret_cast<const uint64_t *>(physical + hhdmOffset);
+    };
+    LeafIterator leaves(parent.roots[0], 0, mapTable);
+    PageTableLeaf leaf;
+    parent.tlb.begin();
+    // leaves come in address order, so the user half is done at the first kernel half leaf
+    while (leaves.next(leaf) && leaf.virtualAddress < kernelHalf) {
+      auto flags = leaf.flags & ~Arch::HARDWARE_FLAGS;
+      if ((flags & Arch::OWNED) && frameAllocator.share(leaf.physicalAddress) && Arch::isWritable(flags)) {
+        flags = Arch::withWrite(flags, false) | Arch::COW;
+        int level;
+        const auto entry = parent.lookup(leaf.virtualAddress, level);
+        *entry = Arch::withWrite(*entry, false) | Arch::COW;
+        parent.tlb.add(leaf.virtualAddress, leaf.pageSize);
+      }
+      mapPages(leaf.physicalAddress, leaf.virtualAddress, leaf.pageSize, 1, flags);
+    }
+    parent.tlb.end();
+    if (sync != nullptr) {
+      sync();
+    }
+    // invalidation that only reaches the current id leaves stale entries behind for a parent that is not active,
+    // dropping its id drops them as well
+    if (!Arch::BROADCAST_INVALIDATION && &parent != active) {
+      parent.asid = {};
+    }
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::destroy() {
+    kassert(kernelSpace != nullptr && this != active);
+    releaseTables(roots[0], 1, Arch::ROOTS > 1 ? PAGE_ENTRIES : indexAt(kernelHalf, 1));
+    for (auto &root: roots) {
+      root = nullptr;
+    }
+    for (auto link = &kernelSpace->spaces; *link != nullptr; link = &(*link)->nextSpace) {
+      if (*link == this) {
+        *link = nextSpace;
+        break;
+      }
+    }
+    kernelSpace = nullptr;
+    asid = {};
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::releaseTables(uint64_t *table, const int level, const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      const auto entry = table[i];
+      if (!(entry & Arch::PRESENT)) {
+        continue;
+      }
+      if (Arch::isTable(entry, level)) {
+        releaseTables(tableAt(entry), level + 1);
+      } else if (entry & Arch::OWNED) {
+        frameAllocator.free(entry & Arch::ADDRESS_MASK & ~(levelSize(level) - 1));
+      }
+    }
+    kassert(freeTable != nullptr);
+    freeTable(table);
+  }
+
+  template<typename Arch>
+  bool PageTable<Arch>::handleWriteFault(const uint64_t virtualAddress) {
+    int level;
+    const auto entry = lookup(virtualAddress, level);
+    if (!(*entry & Arch::PRESENT) || !(*entry & Arch::COW)) {
+      return false;
+    }
+    const auto pageSize = levelSize(level);
+    const auto addressMask = Arch::ADDRESS_MASK & ~(pageSize - 1);
+    auto physical = *entry & addressMask;
+    // the last holder of a shared page just gets write access back
+    if (frameAllocator.countShares(physical) > 0) {
+      const auto copy = frameAllocator.alloc(pageSize / PAGE_SIZE);
+      if (copy == BuddyAllocator::NO_PAGE) {
+        kpanic("out of memory for copy on write");
+      }
+      mapHhdmRange(physical, pageSize);
+      mapHhdmRange(copy, pageSize);
+      memmove(frameAllocator.toVirtual(copy), frameAllocator.toVirtual(physical), pageSize);
+      frameAllocator.free(physical);
+      physical = copy;
+    }
+    // break before make, the output address may change
+    const auto value = Arch::withWrite(*entry & ~(addressMask | Arch::COW), true) | physical;
+    *entry = 0;
+    tlb.add(virtualAddress & ~(pageSize - 1), pageSize);
+    *entry = value;
+    if (sync != nullptr) {
+      sync();
+    }
+    return true;
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::shareRootEntry(const uint16_t index) {
+    if (Arch::ROOTS == 1 && index >= indexAt(kernelHalf, 1)) {
+      for (auto space = spaces; space != nullptr; space = space->nextSpace) {
+        space->roots[0][index] = roots[0][index];
+      }
+    }
+  }
+
+  template<typename Arch>
+  void PageTable<Arch>::setPageTableEntry(uint64_t *table, const uint16_t index, const int level,
+                                          const uint64_t virtualAddress, const uint64_t physicalAddress,
+                                          const uint64_t flags) {
+    const auto newValue = Arch::makeLeaf(physicalAddress, flags, level);
+    if (table[index] != 0 && table[index] != newValue) {
+      kpanicf("attempted to overwrite page table entry for %lx from %lx to %lx", virtualAddress, table[index],
+              newValue);
+    }
+    table[index] = newValue;
+  }
+} // namespace memory
+
+#endif // PAGETABLE_H
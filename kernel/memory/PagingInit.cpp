@@ -0,0 +1,138 @@
+#include <cstdio>
+#include <memutil.h>
+#include "framebuffer/VirtualConsole.h"
+#include "limine.h"
+#include "memory/EarlyArena.h"
+#include "memory/ObjectPool.h"
+#include "memory/paging.h"
+#include "utils/bytes.h"
+#include "utils/panic.h"
+
+// the parts of Paging that do not depend on the architecture, the arch paging.cpp only deals with registers and
+// the tlb
+namespace memory {
+  namespace {
+    size_t mappingCount = 0;
+    limine_memmap_entry **memoryMappings = nullptr;
+
+    struct alignas(PAGE_SIZE) TablePage {
+      uint64_t entries[Paging::PAGE_ENTRIES];
+    };
+
+    ObjectPool<TablePage> pageTablePool;
+
+    void *earlyArenaGetPage(const size_t count) { return earlyArena.alloc(count); }
+
+    void *pageTablePoolGetPage(const size_t count) {
+      kassert(count == 1);
+      return pageTablePool.alloc();
+    }
+
+    void pageTablePoolFree(void *table) { pageTablePool.free(static_cast<TablePage *>(table)); }
+
+    // memory limine leaves to the kernel, mapped through the hhdm on first touch
+    bool limineLazyRange(const uint64_t physical, uint64_t &base, uint64_t &length) {
+      for (size_t i = 0; i < mappingCount; i++) {
+        const auto entry = memoryMappings[i];
+        if (physical >= entry->base && physical < entry->base + entry->length) {
+          const auto type = entry->type;
+          base = entry->base;
+          length = entry->length;
+          return type == LIMINE_MEMMAP_USABLE || type == LIMINE_MEMMAP_ACPI_RECLAIMABLE ||
+                 type == LIMINE_MEMMAP_ACPI_NVS || type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE ||
+                 type == LIMINE_MEMMAP_KERNEL_AND_MODULES;
+        }
+      }
+      return false;
+    }
+
+    // only what is needed to take a fault is mapped up front (kernel, stack, boot info and the framebuffer),
+    // usable memory is mapped through the hhdm on first touch
+    bool isTypeToMap(const uint64_t type) {
+      return type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE || type == LIMINE_MEMMAP_KERNEL_AND_MODULES ||
+             type == LIMINE_MEMMAP_FRAMEBUFFER;
+    }
+
+    bool rangesOverlap(const Paging::PageTableRangeData &range, const limine_memmap_entry *entry) {
+      return range.physicalStart <= entry->base + entry->length && range.physicalEnd >= entry->base;
+    }
+  } // namespace
+
+  void Paging::useTablePool() { setTableAllocator(pageTablePoolGetPage, pageTablePoolFree); }
+
+  void Paging::useLimineMemoryMap(const size_t count, limine_memmap_entry **mappings,
+                                  const uint64_t hhdmVirtualOffset) {
+    if (hhdmVirtualOffset % PAGE_SIZE != 0) {
+      kpanic("virtual offset must be page aligned");
+    }
+    hhdmOffset = hhdmVirtualOffset;
+    active = this;
+    mappingCount = count;
+    memoryMappings = mappings;
+    setTableAllocator(earlyArenaGetPage, nullptr);
+    setLazyRange(limineLazyRange);
+    for (auto &root: roots) {
+      root = allocTable();
+    }
+    for (const auto root: roots) {
+      mapHhdm(tablePhysical(root));
+    }
+  }
+
+  void Paging::copyLimineRange(const PageTableRangeData &range) {
+    const auto isHhdm = range.virtualStart - range.physicalStart == hhdmOffset;
+    bool mapped = false;
+    for (size_t i = 0; i < mappingCount; i++) {
+      const auto entry = memoryMappings[i];
+      if (!rangesOverlap(range, entry) || !isTypeToMap(entry->type)) {
+        continue;
+      }
+      if (!isHhdm) {
+        mapMemory(range.physicalStart, range.virtualStart, range.pageSize, range.pageCount, range.flags);
+        mapped = true;
+        break;
+      }
+      if (entry->type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE) {
+        hhdmFlags = range.flags;
+      }
+      // clip hhdm blocks to the entry so the usable memory around it is left to the fault handler
+      const auto entryEnd = entry->base + entry->length;
+      const auto start = (range.physicalStart > entry->base ? range.physicalStart : entry->base) & ~(PAGE_SIZE - 1);
+      const auto end = ((range.physicalEnd + 1 < entryEnd ? range.physicalEnd + 1 : entryEnd) + PAGE_SIZE - 1) &
+                       ~(PAGE_SIZE - 1);
+      if (start < end && entry->type == LIMINE_MEMMAP_FRAMEBUFFER) {
+        // console output is bound by framebuffer stores, write combining turns them into bursts
+        mapMemory(start, start + hhdmOffset, PAGE_SIZE, (end - start) / PAGE_SIZE, range.flags, MemoryType::WC);
+        mapped = true;
+      } else if (start < end) {
+        mapMemory(start, start + hhdmOffset, PAGE_SIZE, (end - start) / PAGE_SIZE, range.flags);
+        mapped = true;
+      }
+    }
+    if (!mapped && range.pageCount > 2) {
+      char buff[32];
+      kprintf("not mapping %p-%p/%p-%p %lu(%s) %s\n", toPtr(range.virtualStart), toPtr(range.virtualEnd),
+              toPtr(range.physicalStart), toPtr(range.physicalEnd), range.pageCount,
+              bytesToHumanReadable(buff, sizeof(buff), range.pageCount * PAGE_SIZE), tableFlagsToString(range.flags));
+    }
+  }
+
+  char *Paging::tableFlagsToString(const uint64_t flags) {
+    static char buf[32];
+    size_t n = 0;
+    uint64_t unnamed = flags;
+    for (const auto &[flag, name]: FLAG_NAMES) {
+      if (flags & flag) {
+        for (auto c = name; *c; c++) {
+          buf[n++] = *c;
+        }
+        unnamed &= ~flag;
+      }
+    }
+    if (unnamed) {
+      n += ksnprintf(buf + n, sizeof(buf) - n, "%lx", unnamed);
+    }
+    buf[n] = 0;
+    return buf;
+  }
+} // namespace memory
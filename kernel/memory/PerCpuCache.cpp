@@ -0,0 +1,218 @@
+#include "PerCpuCache.h"
+#include "AllocatorStats.h"
+#include "utils/debug.h"
+
+struct Magazine {
+  Magazine *next;
+  size_t rounds;
+  void *objects[PerCpuCache::MAGAZINE_SIZE];
+};
+
+static_assert(sizeof(Magazine) <= SlabAllocator::MAX_SIZE);
+
+Magazine *PerCpuCache::newMagazine() {
+  LockGuard guard(slabLock);
+  const auto magazine = static_cast<Magazine *>(slab->alloc(sizeof(Magazine)));
+  if (magazine != nullptr) {
+    magazine->next = nullptr;
+    magazine->rounds = 0;
+  }
+  return magazine;
+}
+
+void PerCpuCache::releaseMagazine(Magazine *magazine) {
+  LockGuard guard(slabLock);
+  for (size_t i = 0; i < magazine->rounds; i++) {
+    slab->free(magazine->objects[i]);
+  }
+  slab->free(magazine);
+}
+
+void *PerCpuCache::alloc(const size_t size) {
+  if (size > SlabAllocator::MAX_SIZE) {
+    return nullptr;
+  }
+  const auto classIndex = SlabAllocator::sizeClassIndex(size);
+  auto &cache = cpus[cpuId()];
+  auto magazine = cache.loaded[classIndex];
+  if (magazine == nullptr || magazine->rounds == 0) {
+    if (const auto previous = cache.previous[classIndex]; previous != nullptr && previous->rounds > 0) {
+      cache.previous[classIndex] = magazine;
+      cache.loaded[classIndex] = previous;
+      magazine = previous;
+    } else {
+      return refill(cache, classIndex);
+    }
+  }
+  cache.allocCount++;
+  return magazine->objects[--magazine->rounds];
+}
+
+void *PerCpuCache::refill(CpuCache &cache, const size_t classIndex) {
+  cache.refillCount++;
+  auto &depot = depots[classIndex];
+  Magazine *magazine = nullptr;
+  {
+    LockGuard guard(depot.lock);
+    if (depot.full != nullptr) {
+      magazine = depot.full;
+      depot.full = magazine->next;
+      depot.fullCount--;
+      if (const auto previous = cache.previous[classIndex]; previous != nullptr) {
+        previous->next = depot.empty;
+        depot.empty = previous;
+      }
+      cache.previous[classIndex] = cache.loaded[classIndex];
+      cache.loaded[classIndex] = magazine;
+    } else if (cache.loaded[classIndex] == nullptr && depot.empty != nullptr) {
+      cache.loaded[classIndex] = depot.empty;
+      depot.empty = depot.empty->next;
+    }
+  }
+  if (magazine == nullptr) {
+    if (cache.loaded[classIndex] == nullptr) {
+      cache.loaded[classIndex] = newMagazine();
+    }
+    magazine = cache.loaded[classIndex];
+    LockGuard guard(slabLock);
+    if (magazine == nullptr) {
+      const auto ptr = slab->alloc(SlabAllocator::CLASS_SIZES[classIndex]);
+      if (ptr != nullptr) {
+        cache.allocCount++;
+      }
+      return ptr;
+    }
+    // leave half the magazine empty so the frees that usually follow do not immediately overflow it
+    while (magazine->rounds < MAGAZINE_SIZE / 2) {
+      const auto ptr = slab->alloc(SlabAllocator::CLASS_SIZES[classIndex]);
+      if (ptr == nullptr) {
+        break;
+      }
+      magazine->objects[magazine->rounds++] = ptr;
+    }
+    DEBUG_PRINT("Refilled magazine for class " << SlabAllocator::CLASS_SIZES[classIndex] << " with "
+                                               << magazine->rounds << " objects from slab");
+    if (magazine->rounds == 0) {
+      return nullptr;
+    }
+  }
+  cache.allocCount++;
+  return magazine->objects[--magazine->rounds];
+}
+
+bool PerCpuCache::free(void *ptr) {
+  if (ptr == nullptr) {
+    return true;
+  }
+  const auto classIndex = SlabAllocator::classIndexOf(ptr);
+  if (classIndex >= SlabAllocator::CLASS_COUNT) {
+    return false;
+  }
+  auto &cache = cpus[cpuId()];
+  auto magazine = cache.loaded[classIndex];
+  if (magazine == nullptr || magazine->rounds == MAGAZINE_SIZE) {
+    if (const auto previous = cache.previous[classIndex]; previous != nullptr && previous->rounds < MAGAZINE_SIZE) {
+      cache.previous[classIndex] = magazine;
+      cache.loaded[classIndex] = previous;
+      magazine = previous;
+    } else {
+      flushAndPush(cache, classIndex, ptr);
+      return true;
+    }
+  }
+  cache.freeCount++;
+  magazine->objects[magazine->rounds++] = ptr;
+  return true;
+}
+
+void PerCpuCache::flushAndPush(CpuCache &cache, const size_t classIndex, void *ptr) {
+  cache.flushCount++;
+  cache.freeCount++;
+  auto &depot = depots[classIndex];
+  auto full = cache.previous[classIndex];
+  Magazine *empty = nullptr;
+  {
+    LockGuard guard(depot.lock);
+    if (full != nullptr && depot.fullCount < DEPOT_MAX_FULL) {
+      full->next = depot.full;
+      depot.full = full;
+      depot.fullCount++;
+      full = nullptr;
+    }
+    if (depot.empty != nullptr) {
+      empty = depot.empty;
+      depot.empty = empty->next;
+    }
+  }
+  if (full != nullptr) {
+    // the depot is already holding enough, hand the whole magazine back to the slab in one batch
+    LockGuard guard(slabLock);
+    for (size_t i = 0; i < full->rounds; i++) {
+      slab->free(full->objects[i]);
+    }
+    full->rounds = 0;
+    if (empty == nullptr) {
+      empty = full;
+    } else {
+      slab->free(full);
+    }
+  }
+  cache.previous[classIndex] = cache.loaded[classIndex];
+  cache.loaded[classIndex] = empty != nullptr ? empty : newMagazine();
+  if (cache.loaded[classIndex] == nullptr) {
+    LockGuard guard(slabLock);
+    slab->free(ptr);
+    return;
+  }
+  cache.loaded[classIndex]->objects[cache.loaded[classIndex]->rounds++] = ptr;
+}
+
+void PerCpuCache::flush(const size_t cpu) {
+  auto &cache = cpus[cpu];
+  for (size_t classIndex = 0; classIndex < SlabAllocator::CLASS_COUNT; classIndex++) {
+    if (cache.loaded[classIndex] != nullptr) {
+      releaseMagazine(cache.loaded[classIndex]);
+    }
+    if (cache.previous[classIndex] != nullptr) {
+      releaseMagazine(cache.previous[classIndex]);
+    }
+    cache.loaded[classIndex] = nullptr;
+    cache.previous[classIndex] = nullptr;
+    auto &depot = depots[classIndex];
+    Magazine *lists[2];
+    {
+      LockGuard guard(depot.lock);
+      lists[0] = depot.full;
+      lists[1] = depot.empty;
+      depot.full = nullptr;
+      depot.empty = nullptr;
+      depot.fullCount = 0;
+    }
+    for (auto list: lists) {
+      while (list != nullptr) {
+        const auto next = list->next;
+        releaseMagazine(list);
+        list = next;
+      }
+    }
+  }
+}
+
+void PerCpuCache::writeStats(const StatsFormatter &out) const {
+  for (size_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+    const auto &cache = cpus[cpu];
+    if (cache.allocCount != 0 || cache.freeCount != 0) {
+      out.value("allocs", cpu, cache.allocCount);
+      out.value("frees", cpu, cache.freeCount);
+      out.value("refills", cpu, cache.refillCount);
+      out.value("flushes", cpu, cache.flushCount);
+    }
+  }
+  for (size_t i = 0; i < SlabAllocator::CLASS_COUNT; i++) {
+    if (depots[i].fullCount != 0) {
+      out.value("depot_full", SlabAllocator::CLASS_SIZES[i], depots[i].fullCount);
+    }
+  }
+}
+
+PerCpuCache defaultCpuCache;
@@ -0,0 +1,79 @@
+#ifndef PERCPUCACHE_H
+#define PERCPUCACHE_H
+
+#include <cstddef>
+#include "SlabAllocator.h"
+#include "utils/spinlock.h"
+
+#ifndef MAX_CPUS
+#define MAX_CPUS 64
+#endif
+
+typedef size_t (*cpuId_t)();
+
+struct Magazine;
+
+// Per-CPU magazine layer in front of a shared SlabAllocator. Each CPU owns a loaded and a previous magazine per size
+// class, so the common alloc/free path only touches that CPU's cache line. Empty or full magazines are exchanged with a
+// locked per-class depot, and the slab itself is only touched in batches when the depot cannot satisfy a request.
+class PerCpuCache {
+public:
+  static constexpr size_t MAGAZINE_SIZE = 30;
+  static constexpr size_t DEPOT_MAX_FULL = 8;
+
+  PerCpuCache() = default;
+
+  [[nodiscard]] explicit PerCpuCache(SlabAllocator *slab, const cpuId_t cpu_id) : slab(slab), cpuId(cpu_id) {}
+
+  // returns nullptr if size is larger than SlabAllocator::MAX_SIZE or the slab is out of pages
+  [[nodiscard]] void *alloc(size_t size);
+
+  // returns false if ptr does not belong to a slab page
+  bool free(void *ptr);
+
+  // return all objects cached for a cpu to the depot, and everything in the depot to the slab
+  void flush(size_t cpu);
+
+  void setCpuIdSource(const cpuId_t cpu_id) { cpuId = cpu_id; }
+
+  [[nodiscard]] size_t countAlloc(const size_t cpu) const { return cpus[cpu].allocCount; }
+  [[nodiscard]] size_t countFree(const size_t cpu) const { return cpus[cpu].freeCount; }
+  [[nodiscard]] size_t countRefill(const size_t cpu) const { return cpus[cpu].refillCount; }
+  [[nodiscard]] size_t countFlush(const size_t cpu) const { return cpus[cpu].flushCount; }
+
+  void writeStats(const StatsFormatter &out) const;
+
+protected:
+  struct alignas(64) CpuCache {
+    Magazine *loaded[SlabAllocator::CLASS_COUNT];
+    Magazine *previous[SlabAllocator::CLASS_COUNT];
+    size_t allocCount;
+    size_t freeCount;
+    size_t refillCount;
+    size_t flushCount;
+  };
+
+  struct Depot {
+    Spinlock lock;
+    Magazine *full;
+    Magazine *empty;
+    size_t fullCount;
+  };
+
+  [[nodiscard]] void *refill(CpuCache &cache, size_t classIndex);
+  void flushAndPush(CpuCache &cache, size_t classIndex, void *ptr);
+  [[nodiscard]] Magazine *newMagazine();
+  void releaseMagazine(Magazine *magazine);
+
+  static size_t singleCpu() { return 0; }
+
+  SlabAllocator *slab = &defaultSlab;
+  cpuId_t cpuId = singleCpu;
+  Spinlock slabLock;
+  Depot depots[SlabAllocator::CLASS_COUNT] = {};
+  CpuCache cpus[MAX_CPUS] = {};
+};
+
+extern PerCpuCache defaultCpuCache;
+
+#endif // PERCPUCACHE_H
@@ -0,0 +1,130 @@
+#ifndef SIMULATEDMEMORY_H
+#define SIMULATEDMEMORY_H
+
+#include <cstdint>
+#include <sys/mman.h>
+#include <vector>
+#include "PageTable.h"
+
+// Physical memory for running the page table engine on the host. It is a 1 GiB reservation that is only backed
+// once touched, physical addresses are offsets into it and the hhdm starts at its base. The base is 1 GiB aligned,
+// so the first lazy hhdm mapping covers all of it and table counts do not depend on where the host put it.
+class SimulatedMemory {
+public:
+  static constexpr uint64_t SIZE = 1ull << 30;
+
+  SimulatedMemory() {
+    reservation = mmap(nullptr, SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    base = (reinterpret_cast<uint64_t>(reservation) + SIZE - 1) & ~(SIZE - 1);
+    instance = this;
+  }
+
+  ~SimulatedMemory() {
+    munmap(reservation, SIZE * 2);
+    instance = nullptr;
+  }
+
+  SimulatedMemory(const SimulatedMemory &) = delete;
+  SimulatedMemory &operator=(const SimulatedMemory &) = delete;
+
+  [[nodiscard]] uint64_t hhdmOffset() const { return base; }
+  [[nodiscard]] uint64_t countTables() const { return tables; }
+  [[nodiscard]] uint64_t peakTables() const { return peak; }
+
+  static void *allocTable(const size_t count) {
+    auto &memory = *instance;
+    uint64_t physical;
+    if (count == 1 && !memory.freeTables.empty()) {
+      physical = memory.freeTables.back();
+      memory.freeTables.pop_back();
+    } else {
+      physical = memory.next;
+      if (physical + PAGE_SIZE * count > SIZE) {
+        return nullptr;
+      }
+      memory.next += PAGE_SIZE * count;
+    }
+    memory.tables += count;
+    if (memory.tables > memory.peak) {
+      memory.peak = memory.tables;
+    }
+    return reinterpret_cast<void *>(physical + memory.base);
+  }
+
+  static void freeTable(void *table) {
+    auto &memory = *instance;
+    memory.freeTables.push_back(reinterpret_cast<uint64_t>(table) - memory.base);
+    memory.tables--;
+  }
+
+  // all of it may be mapped through the hhdm on demand
+  static bool lazyRange(const uint64_t physical, uint64_t &base, uint64_t &length) {
+    base = 0;
+    length = SIZE;
+    return physical < SIZE;
+  }
+
+private:
+  static inline SimulatedMemory *instance = nullptr;
+
+  void *reservation = nullptr;
+  uint64_t base = 0;
+  // page 0 stays unused so a physical address of 0 is never a table
+  uint64_t next = PAGE_SIZE;
+  uint64_t tables = 0;
+  uint64_t peak = 0;
+  std::vector<uint64_t> freeTables;
+};
+
+// an address space backed by SimulatedMemory, laid out the way Paging::init leaves it
+template<typename Arch>
+class SimulatedPageTable : public memory::PageTable<Arch> {
+public:
+  using Leaf = typename memory::PageTable<Arch>::PageTableLeaf;
+
+  explicit SimulatedPageTable(const SimulatedMemory &memory) :
+      memory::PageTable<Arch>(invalidatePage, invalidateAll) {
+    this->setTableAllocator(SimulatedMemory::allocTable, SimulatedMemory::freeTable);
+    this->setLazyRange(SimulatedMemory::lazyRange);
+    this->hhdmOffset = memory.hhdmOffset();
+    for (auto &root: this->roots) {
+      root = this->allocTable();
+    }
+    for (const auto root: this->roots) {
+      this->mapHhdm(this->tablePhysical(root));
+    }
+  }
+
+  // an address space without tables, for createFrom and forkFrom
+  SimulatedPageTable() : memory::PageTable<Arch>(invalidatePage, invalidateAll) {}
+
+  [[nodiscard]] uint64_t kernelHalfStart() const { return this->kernelHalf; }
+
+  // none of the simulated address spaces is active, so their ids behave like those of a switched out space
+  void acquireAsid() { this->asids.acquire(this->asid); }
+  [[nodiscard]] bool hasAsid() const { return this->asid.generation != 0; }
+
+  // the leaves mapping [start, end), start and end have to lie in the same half
+  [[nodiscard]] std::vector<Leaf> leaves(const uint64_t start, const uint64_t end) const {
+    const auto mapTable = [this](const uint64_t physical) {
+      return reinterpret_cast<const uint64_t *>(physical + this->hhdmOffset);
+    };
+    const auto kernel = Arch::ROOTS > 1 && start >= this->kernelHalf;
+    typename memory::PageTable<Arch>::template LeafIterator<decltype(mapTable)> iterator(
+        this->rootFor(start), kernel ? this->kernelHalf : 0, mapTable);
+    std::vector<Leaf> result;
+    Leaf leaf;
+    while (iterator.next(leaf)) {
+      if (leaf.virtualAddress >= start && leaf.virtualAddress < end) {
+        result.push_back(leaf);
+      }
+    }
+    return result;
+  }
+
+private:
+  static void invalidatePage(uint64_t) {}
+  static void invalidateAll() {}
+};
+
+#endif // SIMULATEDMEMORY_H
@@ -0,0 +1,189 @@
+#include "SlabAllocator.h"
+#include "AllocatorStats.h"
+#include "utils/debug.h"
+
+constexpr uint64_t SLAB_MAGIC = 0x51AB51AB51AB51ABull;
+
+struct SlabPage {
+  uint64_t magic;
+  SlabPage *self;
+  SlabPage *next;
+  SlabPage *prev;
+  void *freeList;
+  uint16_t classIndex;
+  uint16_t inUse;
+  uint16_t capacity;
+  uint16_t unused;
+};
+
+static_assert(sizeof(SlabPage) <= SlabAllocator::HEADER_SIZE);
+
+namespace {
+  constexpr size_t CLASS_STEP = 16;
+
+  struct SizeClassTable {
+    uint8_t index[SlabAllocator::MAX_SIZE / CLASS_STEP + 1];
+
+    constexpr SizeClassTable() : index() {
+      size_t c = 0;
+      for (size_t i = 0; i < sizeof(index); i++) {
+        while (SlabAllocator::CLASS_SIZES[c] < i * CLASS_STEP) {
+          c++;
+        }
+        index[i] = c;
+      }
+    }
+  };
+
+  constexpr SizeClassTable sizeClassTable;
+
+  SlabPage *pageOf(const void *ptr) {
+    return reinterpret_cast<SlabPage *>(reinterpret_cast<uintptr_t>(ptr) & ~static_cast<uintptr_t>(PAGE_SIZE - 1));
+  }
+} // namespace
+
+size_t SlabAllocator::sizeClassIndex(const size_t size) {
+  return sizeClassTable.index[(size + CLASS_STEP - 1) / CLASS_STEP];
+}
+
+size_t SlabAllocator::classIndexOf(const void *ptr) {
+  const auto page = pageOf(ptr);
+  if (ptr == page || page->magic != SLAB_MAGIC || page->self != page || page->classIndex >= CLASS_COUNT) {
+    return CLASS_COUNT;
+  }
+  const auto offset = static_cast<size_t>(static_cast<const char *>(ptr) - reinterpret_cast<const char *>(page));
+  if (offset < HEADER_SIZE || (offset - HEADER_SIZE) % CLASS_SIZES[page->classIndex] != 0) {
+    return CLASS_COUNT;
+  }
+  return page->classIndex;
+}
+
+void SlabAllocator::linkPage(SlabPage *page, const size_t classIndex) {
+  auto &cache = caches[classIndex];
+  page->prev = nullptr;
+  page->next = cache.partial;
+  if (cache.partial != nullptr) {
+    cache.partial->prev = page;
+  }
+  cache.partial = page;
+}
+
+void SlabAllocator::unlinkPage(SlabPage *page, const size_t classIndex) {
+  auto &cache = caches[classIndex];
+  if (page->prev != nullptr) {
+    page->prev->next = page->next;
+  } else {
+    cache.partial = page->next;
+  }
+  if (page->next != nullptr) {
+    page->next->prev = page->prev;
+  }
+  page->next = nullptr;
+  page->prev = nullptr;
+}
+
+SlabPage *SlabAllocator::newPage(const size_t classIndex) {
+  const auto page = static_cast<SlabPage *>(getPage(1));
+  if (page == nullptr) {
+    return nullptr;
+  }
+  const auto objectSize = CLASS_SIZES[classIndex];
+  page->magic = SLAB_MAGIC;
+  page->self = page;
+  page->classIndex = classIndex;
+  page->inUse = 0;
+  page->capacity = (PAGE_SIZE - HEADER_SIZE) / objectSize;
+  page->unused = 0;
+  page->freeList = nullptr;
+  linkPage(page, classIndex);
+  caches[classIndex].emptyPages++;
+  pageCount++;
+  DEBUG_PRINT("New slab page for class " << objectSize << " with " << page->capacity << " objects");
+  return page;
+}
+
+void *SlabAllocator::alloc(const size_t size) {
+  if (size > MAX_SIZE) {
+    return nullptr;
+  }
+  const auto classIndex = sizeClassIndex(size);
+  auto &cache = caches[classIndex];
+  auto page = cache.partial;
+  if (page == nullptr) {
+    page = newPage(classIndex);
+    if (page == nullptr) {
+      return nullptr;
+    }
+  }
+  void *ptr;
+  if (page->freeList != nullptr) {
+    ptr = page->freeList;
+    page->freeList = *static_cast<void **>(ptr);
+  } else {
+    ptr = reinterpret_cast<char *>(page) + HEADER_SIZE + page->unused * CLASS_SIZES[classIndex];
+    page->unused++;
+  }
+  if (page->inUse++ == 0) {
+    cache.emptyPages--;
+  }
+  if (page->inUse == page->capacity) {
+    unlinkPage(page, classIndex);
+  }
+  sizeInUse += CLASS_SIZES[classIndex];
+  if (sizeInUse > peakInUse) {
+    peakInUse = sizeInUse;
+  }
+  cache.allocCount++;
+  cache.inUse++;
+  allocCount++;
+  return ptr;
+}
+
+bool SlabAllocator::free(void *ptr) {
+  if (ptr == nullptr) {
+    return true;
+  }
+  if (!isSlabObject(ptr)) {
+    return false;
+  }
+  const auto page = pageOf(ptr);
+  const auto classIndex = page->classIndex;
+  auto &cache = caches[classIndex];
+  if (page->inUse == page->capacity) {
+    linkPage(page, classIndex);
+  }
+  *static_cast<void **>(ptr) = page->freeList;
+  page->freeList = ptr;
+  sizeInUse -= CLASS_SIZES[classIndex];
+  cache.inUse--;
+  freeCount++;
+  if (--page->inUse == 0) {
+    // keep one empty page per class around so a single alloc/free pair does not bounce pages
+    if (cache.emptyPages > 0) {
+      unlinkPage(page, classIndex);
+      page->magic = 0;
+      page->self = nullptr;
+      pageCount--;
+      freePage(page);
+    } else {
+      cache.emptyPages++;
+    }
+  }
+  return true;
+}
+
+void SlabAllocator::writeStats(const StatsFormatter &out) const {
+  out.value("used", sizeInUse);
+  out.value("peak_used", peakInUse);
+  out.value("pages", pageCount);
+  out.value("allocs", allocCount);
+  out.value("frees", freeCount);
+  for (size_t i = 0; i < CLASS_COUNT; i++) {
+    if (caches[i].allocCount != 0) {
+      out.value("class_allocs", CLASS_SIZES[i], caches[i].allocCount);
+      out.value("class_in_use", CLASS_SIZES[i], caches[i].inUse);
+    }
+  }
+}
+
+SlabAllocator defaultSlab;
@@ -0,0 +1,73 @@
+#ifndef SLABALLOCATOR_H
+#define SLABALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include "memalloc.h"
+
+struct SlabPage;
+
+// Serves small allocations from per size class free lists carved out of single pages. Every slab page starts with a
+// SlabPage header so the owning class can be found from any object pointer without a per-object header.
+class SlabAllocator {
+public:
+  static constexpr size_t CLASS_COUNT = 15;
+  static constexpr size_t HEADER_SIZE = 64;
+  static constexpr size_t CLASS_SIZES[CLASS_COUNT] = {16, 32, 48, 64, 80, 96, 112, 128, 192, 256, 384, 512, 672, 1008,
+                                                      2016};
+  static constexpr size_t MAX_SIZE = CLASS_SIZES[CLASS_COUNT - 1];
+
+  static_assert(PAGE_SIZE - HEADER_SIZE >= MAX_SIZE * 2);
+
+  SlabAllocator() = default;
+
+  [[nodiscard]] explicit SlabAllocator(const getPage_t get_page, const freePage_t free_page) :
+      getPage(get_page), freePage(free_page) {}
+
+  // returns nullptr if size is larger than MAX_SIZE or no page could be allocated
+  [[nodiscard]] void *alloc(size_t size);
+
+  // returns false if ptr does not belong to a slab page
+  bool free(void *ptr);
+
+  [[nodiscard]] static bool isSlabObject(const void *ptr) { return classIndexOf(ptr) < CLASS_COUNT; }
+  // returns CLASS_COUNT if ptr does not belong to a slab page
+  [[nodiscard]] static size_t classIndexOf(const void *ptr);
+  [[nodiscard]] static size_t sizeClassIndex(size_t size);
+
+  [[nodiscard]] size_t usedSize() const { return sizeInUse; }
+  [[nodiscard]] size_t countAlloc() const { return allocCount; }
+  [[nodiscard]] size_t countFree() const { return freeCount; }
+  [[nodiscard]] size_t countPages() const { return pageCount; }
+  [[nodiscard]] size_t peakUsedSize() const { return peakInUse; }
+  [[nodiscard]] size_t countClassAlloc(const size_t classIndex) const { return caches[classIndex].allocCount; }
+  [[nodiscard]] size_t countClassInUse(const size_t classIndex) const { return caches[classIndex].inUse; }
+
+  void writeStats(const StatsFormatter &out) const;
+
+protected:
+  struct SlabCache {
+    SlabPage *partial = nullptr;
+    size_t emptyPages = 0;
+    size_t allocCount = 0;
+    size_t inUse = 0;
+  };
+
+  SlabPage *newPage(size_t classIndex);
+  void linkPage(SlabPage *page, size_t classIndex);
+  void unlinkPage(SlabPage *page, size_t classIndex);
+
+  SlabCache caches[CLASS_COUNT] = {};
+  size_t sizeInUse = 0;
+  size_t peakInUse = 0;
+  size_t allocCount = 0;
+  size_t freeCount = 0;
+  size_t pageCount = 0;
+
+  getPage_t getPage = ::getPage;
+  freePage_t freePage = ::freePage;
+};
+
+extern SlabAllocator defaultSlab;
+
+#endif // SLABALLOCATOR_H
@@ -0,0 +1,101 @@
+#include "TlbBatch.h"
+#include "AllocatorStats.h"
+
+namespace memory {
+  void TlbBatch::end() {
+    if (depth > 0 && --depth == 0) {
+      flush();
+    }
+  }
+
+  void TlbBatch::extend(const size_t index, const uint64_t start, const uint64_t end) {
+    auto &range = ranges[index];
+    pendingPages -= (range.end - range.start) / PAGE_SIZE;
+    range.start = start < range.start ? start : range.start;
+    range.end = end > range.end ? end : range.end;
+    pendingPages += (range.end - range.start) / PAGE_SIZE;
+  }
+
+  void TlbBatch::add(const uint64_t virtualAddress, const uint64_t size) {
+    const auto start = virtualAddress & ~static_cast<uint64_t>(PAGE_SIZE - 1);
+    const auto end = (virtualAddress + size + PAGE_SIZE - 1) & ~static_cast<uint64_t>(PAGE_SIZE - 1);
+    if (!fullFlush) {
+      size_t i = 0;
+      // merge with a range it touches, the common case is a run of neighbouring pages
+      while (i < rangeCount && (start > ranges[i].end || end < ranges[i].start)) {
+        i++;
+      }
+      if (i < rangeCount) {
+        extend(i, start, end);
+        // the grown range can now touch others, absorb them so the ranges stay disjoint and no page is counted twice
+        for (size_t j = 0; j < rangeCount;) {
+          if (j == i || ranges[j].start > ranges[i].end || ranges[j].end < ranges[i].start) {
+            j++;
+            continue;
+          }
+          pendingPages -= (ranges[j].end - ranges[j].start) / PAGE_SIZE;
+          extend(i, ranges[j].start, ranges[j].end);
+          ranges[j] = ranges[--rangeCount];
+          if (i == rangeCount) {
+            i = j;
+          }
+          j = 0;
+        }
+      } else if (rangeCount == MAX_RANGES) {
+        fullFlush = true;
+      } else {
+        ranges[rangeCount++] = {start, end};
+        pendingPages += (end - start) / PAGE_SIZE;
+      }
+      if (pendingPages > FULL_FLUSH_PAGES) {
+        fullFlush = true;
+      }
+    }
+    if (depth == 0) {
+      flush();
+    }
+  }
+
+  void TlbBatch::addAll() {
+    fullFlush = true;
+    if (depth == 0) {
+      flush();
+    }
+  }
+
+  void TlbBatch::flush() {
+    if (rangeCount == 0 && !fullFlush) {
+      return;
+    }
+    if (fullFlush) {
+      invalidateAll();
+      fullFlushCount++;
+    } else {
+      if (sync != nullptr) {
+        sync();
+      }
+      for (size_t i = 0; i < rangeCount; i++) {
+        for (auto address = ranges[i].start; address < ranges[i].end; address += PAGE_SIZE) {
+          invalidatePage(address);
+        }
+      }
+      if (sync != nullptr) {
+        sync();
+      }
+      pageInvalidations += pendingPages;
+    }
+    flushCount++;
+    if (shootdown != nullptr) {
+      shootdown(*this);
+    }
+    rangeCount = 0;
+    pendingPages = 0;
+    fullFlush = false;
+  }
+
+  void TlbBatch::writeStats(const StatsFormatter &out) const {
+    out.value("flushes", flushCount);
+    out.value("page_invalidations", pageInvalidations);
+    out.value("full_flushes", fullFlushCount);
+  }
+} // namespace memory
@@ -0,0 +1,83 @@
+#ifndef TLBBATCH_H
+#define TLBBATCH_H
+
+#include <cstddef>
+#include <cstdint>
+
+class StatsFormatter;
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+
+namespace memory {
+  // Collects the virtual ranges whose translations changed during a batch of map/unmap operations and invalidates
+  // them once the outermost batch ends. Small batches are invalidated page by page, anything larger than
+  // FULL_FLUSH_PAGES or spread over more than MAX_RANGES ranges flushes the whole TLB instead.
+  class TlbBatch {
+  public:
+    static constexpr size_t MAX_RANGES = 8;
+    static constexpr uint64_t FULL_FLUSH_PAGES = 32;
+
+    struct Range {
+      uint64_t start;
+      uint64_t end;
+    };
+
+    using invalidatePage_t = void (*)(uint64_t virtualAddress);
+    using invalidateAll_t = void (*)();
+    // ordering around a run of page invalidations, may be nullptr
+    using sync_t = void (*)();
+    // repeats a flush on the other cpus, called with the batch before it is cleared
+    using shootdown_t = void (*)(const TlbBatch &batch);
+
+    TlbBatch() = default;
+
+    [[nodiscard]] explicit TlbBatch(const invalidatePage_t invalidate_page, const invalidateAll_t invalidate_all,
+                                    const sync_t sync = nullptr) :
+        invalidatePage(invalidate_page), invalidateAll(invalidate_all), sync(sync) {}
+
+    void begin() { depth++; }
+    [[nodiscard]] bool inBatch() const { return depth > 0; }
+    // flushes when the outermost batch ends
+    void end();
+
+    // records a changed range, outside of a batch it is flushed right away
+    void add(uint64_t virtualAddress, uint64_t size);
+    // records a change only a full flush covers, such as a freed page table other ids may still cache
+    void addAll();
+    void flush();
+
+    // installed once other cpus are running
+    void setShootdown(const shootdown_t handler) { shootdown = handler; }
+
+    [[nodiscard]] bool isFullFlush() const { return fullFlush; }
+    [[nodiscard]] size_t countRanges() const { return rangeCount; }
+    [[nodiscard]] const Range &range(const size_t index) const { return ranges[index]; }
+
+    [[nodiscard]] uint64_t countFlushes() const { return flushCount; }
+    [[nodiscard]] uint64_t countPageInvalidations() const { return pageInvalidations; }
+    [[nodiscard]] uint64_t countFullFlushes() const { return fullFlushCount; }
+
+    void writeStats(const StatsFormatter &out) const;
+
+  protected:
+    invalidatePage_t invalidatePage = nullptr;
+    invalidateAll_t invalidateAll = nullptr;
+    sync_t sync = nullptr;
+    shootdown_t shootdown = nullptr;
+    Range ranges[MAX_RANGES] = {};
+    size_t rangeCount = 0;
+    uint64_t pendingPages = 0;
+    bool fullFlush = false;
+    int depth = 0;
+    uint64_t flushCount = 0;
+    uint64_t pageInvalidations = 0;
+    uint64_t fullFlushCount = 0;
+
+    // grows ranges[index] to cover [start, end) and counts the pages it gained
+    void extend(size_t index, uint64_t start, uint64_t end);
+  };
+} // namespace memory
+
+#endif // TLBBATCH_H
@@ -1,5 +1,16 @@
 #include "get-page.h"
+#include "BuddyAllocator.h"
 
-void *getPage(const size_t count) { return nullptr; }
+void *getPage(const size_t count) {
+  const auto physical = memory::frameAllocator.alloc(count);
+  if (physical == memory::BuddyAllocator::NO_PAGE) {
+    return nullptr;
+  }
+  return memory::frameAllocator.toVirtual(physical);
+}
 
-void freePage(void *ptr) {}
+void freePage(void *ptr) {
+  if (ptr != nullptr) {
+    memory::frameAllocator.free(memory::frameAllocator.toPhysical(ptr));
+  }
+}
@@ -1,141 +1,379 @@
 #include "memalloc.h"
+#include <new>
+#include "AllocatorStats.h"
+#include "PerCpuCache.h"
+#include "SlabAllocator.h"
+#include "utils/spinlock.h"
 #include "utils/debug.h"
+#include "utils/panic.h"
 
 struct MemBlock {
-  size_t size;
+  // payload size in the upper bits, BLOCK_* flags in the alignment bits
+  size_t header;
 
   union {
-    MemBlock *next;
+    struct {
+      MemBlock *next;
+      MemBlock *prev;
+    } link;
+
     char data[1];
   };
 };
 
-static_assert(sizeof(MemBlock) == 16);
+static_assert(sizeof(MemBlock) == 24);
 
-constexpr auto memBlockHeaderSize = sizeof(MemBlock) - sizeof(decltype(MemBlock::next));
+namespace {
+  constexpr size_t BLOCK_FREE = 1;
+  constexpr size_t BLOCK_PREV_FREE = 2;
+  constexpr size_t BLOCK_SPAN_START = 4;
+  constexpr size_t BLOCK_FLAGS = MemPool::ALIGN_SIZE - 1;
 
-void MemPool::removeFreeBlock(MemBlock *block, MemBlock *prev) {
-  sizeFree -= block->size;
-  if (prev == nullptr) {
-    freeBlocks = block->next;
-  } else {
-    prev->next = block->next;
+  size_t blockSize(const MemBlock *block) { return block->header & ~BLOCK_FLAGS; }
+
+  bool isFree(const MemBlock *block) { return (block->header & BLOCK_FREE) != 0; }
+
+  bool isPrevFree(const MemBlock *block) { return (block->header & BLOCK_PREV_FREE) != 0; }
+
+  bool isSpanStart(const MemBlock *block) { return (block->header & BLOCK_SPAN_START) != 0; }
+
+  void setSize(MemBlock *block, const size_t size) { block->header = size | (block->header & BLOCK_FLAGS); }
+
+  MemBlock *nextBlock(MemBlock *block) { return reinterpret_cast<MemBlock *>(block->data + blockSize(block)); }
+
+  // a free block keeps a copy of its size in its last word, right in front of the next block's header
+  MemBlock *prevBlock(MemBlock *block) {
+    const auto prevSize = *(reinterpret_cast<size_t *>(block) - 1);
+    return reinterpret_cast<MemBlock *>(reinterpret_cast<char *>(block) - prevSize - MemPool::HEADER_SIZE);
   }
-  block->next = nullptr;
-}
 
-MemBlock *MemPool::findExistingFreeBlock(const size_t size) {
-  auto ptr = this->freeBlocks;
-  MemBlock *prev = nullptr;
-  while (ptr) {
-    if (ptr->size >= size) {
-      DEBUG_PRINT("Found block of size " << ptr->size << " for " << size << " bytes in use: " << sizeInUse
-                                         << " free: " << sizeFree);
-      this->sizeInUse += ptr->size;
-      removeFreeBlock(ptr, prev);
-      DEBUG_PRINT("in use: " << this->sizeInUse << " free: " << this->sizeFree);
-      return ptr;
+  void markFree(MemBlock *block) {
+    block->header |= BLOCK_FREE;
+    *(reinterpret_cast<size_t *>(nextBlock(block)) - 1) = blockSize(block);
+    nextBlock(block)->header |= BLOCK_PREV_FREE;
+  }
+
+  void markUsed(MemBlock *block) {
+    block->header &= ~BLOCK_FREE;
+    nextBlock(block)->header &= ~BLOCK_PREV_FREE;
+  }
+
+  size_t fls(const size_t value) { return 63 - __builtin_clzll(value); }
+
+  void mappingInsert(const size_t size, size_t *fl, size_t *sl) {
+    if (size < MemPool::SMALL_BLOCK_SIZE) {
+      *fl = 0;
+      *sl = size / (MemPool::SMALL_BLOCK_SIZE / MemPool::SL_INDEX_COUNT);
+    } else {
+      const auto f = fls(size);
+      *sl = (size >> (f - MemPool::SL_INDEX_COUNT_LOG2)) ^ MemPool::SL_INDEX_COUNT;
+      *fl = f - (MemPool::FL_INDEX_SHIFT - 1);
+    }
+  }
+
+  // round up to the next list boundary so any block on the list found is big enough
+  void mappingSearch(size_t size, size_t *fl, size_t *sl) {
+    if (size >= MemPool::SMALL_BLOCK_SIZE) {
+      size += (static_cast<size_t>(1) << (fls(size) - MemPool::SL_INDEX_COUNT_LOG2)) - 1;
     }
-    prev = ptr;
-    ptr = ptr->next;
+    mappingInsert(size, fl, sl);
   }
-  return nullptr;
+} // namespace
+
+size_t MemPool::adjustSize(const size_t size) {
+  const auto aligned = (size + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1);
+  return aligned < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : aligned;
 }
 
-void *MemPool::alloc(const size_t size) {
-  DEBUG_PRINT("Allocating " << size << " bytes");
-  for (auto i = 0; i <= 1; i++) {
-    auto block = findExistingFreeBlock(size);
-    if (block != nullptr) {
-      DEBUG_PRINT("Allocated " << size << " bytes from existing block of size " << block->size);
-      if (block->size > size + memBlockHeaderSize) {
-        const auto next = reinterpret_cast<MemBlock *>(block->data + size);
-        next->size = block->size - size - memBlockHeaderSize;
-        DEBUG_PRINT("Returning " << size << " bytes and adding " << block->size
-                                 << " bytes back to free list. in use: " << sizeInUse << " free: " << sizeFree);
-        sizeInUse -= next->size + memBlockHeaderSize;
-        DEBUG_PRINT("in use: " << this->sizeInUse << " free: " << this->sizeFree);
-        addFreeBlock(next);
-        block->size = size;
+void MemPool::insertFreeBlock(MemBlock *block) {
+  size_t fl;
+  size_t sl;
+  mappingInsert(blockSize(block), &fl, &sl);
+  const auto head = freeBlocks[fl][sl];
+  block->link.next = head;
+  block->link.prev = nullptr;
+  if (head != nullptr) {
+    head->link.prev = block;
+  }
+  freeBlocks[fl][sl] = block;
+  flBitmap |= 1ull << fl;
+  slBitmap[fl] |= 1u << sl;
+  markFree(block);
+  sizeFree += blockSize(block);
+  freeBlockCount++;
+}
+
+void MemPool::removeFreeBlock(MemBlock *block) {
+  size_t fl;
+  size_t sl;
+  mappingInsert(blockSize(block), &fl, &sl);
+  if (block->link.prev != nullptr) {
+    block->link.prev->link.next = block->link.next;
+  } else {
+    freeBlocks[fl][sl] = block->link.next;
+    if (freeBlocks[fl][sl] == nullptr) {
+      slBitmap[fl] &= ~(1u << sl);
+      if (slBitmap[fl] == 0) {
+        flBitmap &= ~(1ull << fl);
       }
-      allocCount++;
-      return block->data;
     }
-    const auto pages = (size + memBlockHeaderSize) / PAGE_SIZE + 1;
-    DEBUG_PRINT("no pre-allocated block found, allocating " << pages << " pages");
-    const auto page = getPage(pages);
-    if (page == nullptr) {
+  }
+  if (block->link.next != nullptr) {
+    block->link.next->link.prev = block->link.prev;
+  }
+  markUsed(block);
+  sizeFree -= blockSize(block);
+  freeBlockCount--;
+}
+
+MemBlock *MemPool::findFreeBlock(const size_t size) {
+  size_t fl;
+  size_t sl;
+  mappingSearch(size, &fl, &sl);
+  if (fl >= FL_INDEX_COUNT) {
+    return nullptr;
+  }
+  auto slMap = slBitmap[fl] & (~0u << sl);
+  if (slMap == 0) {
+    const auto flMap = fl + 1 < 64 ? flBitmap & (~0ull << (fl + 1)) : 0;
+    if (flMap == 0) {
       return nullptr;
     }
-    block = static_cast<MemBlock *>(page);
-    block->size = pages * PAGE_SIZE - memBlockHeaderSize;
-    addFreeBlock(block);
+    fl = __builtin_ctzll(flMap);
+    slMap = slBitmap[fl];
+  }
+  sl = __builtin_ctz(slMap);
+  const auto block = freeBlocks[fl][sl];
+  DEBUG_PRINT("Found block of size " << blockSize(block) << " for " << size << " bytes in use: " << sizeInUse
+                                     << " free: " << sizeFree);
+  removeFreeBlock(block);
+  return block;
+}
+
+MemBlock *MemPool::addSpan(void *page, const size_t pages) {
+  // a span is one free block followed by a zero sized used sentinel that stops merging past the end of the span
+  const auto block = static_cast<MemBlock *>(page);
+  block->header = BLOCK_SPAN_START;
+  setSize(block, pages * PAGE_SIZE - HEADER_SIZE * 2);
+  nextBlock(block)->header = 0;
+  pageCount += pages;
+  insertFreeBlock(block);
+  return block;
+}
+
+void MemPool::useBlock(MemBlock *block, const size_t size) {
+  const auto available = blockSize(block);
+  if (available >= size + HEADER_SIZE + MIN_BLOCK_SIZE) {
+    setSize(block, size);
+    const auto rest = nextBlock(block);
+    rest->header = 0;
+    setSize(rest, available - size - HEADER_SIZE);
+    insertFreeBlock(rest);
+  }
+  sizeInUse += blockSize(block);
+  if (sizeInUse > peakInUse) {
+    peakInUse = sizeInUse;
+  }
+  size_t fl;
+  size_t sl;
+  mappingInsert(size, &fl, &sl);
+  allocHistogram[fl]++;
+}
+
+bool MemPool::releaseSpan(MemBlock *block) {
+  // only a block that starts a span and runs up to its sentinel covers the whole span
+  if (!isSpanStart(block) || blockSize(nextBlock(block)) != 0 || sizeFree + blockSize(block) <= retainSize) {
+    return false;
   }
-  return nullptr;
+  const auto pages = (blockSize(block) + HEADER_SIZE * 2) / PAGE_SIZE;
+  DEBUG_PRINT("Releasing span of " << pages << " pages");
+  pageCount -= pages;
+  freePage(block);
+  return true;
+}
+
+MemBlock *MemPool::takeBlock(const size_t size) {
+  if (const auto block = findFreeBlock(size); block != nullptr) {
+    return block;
+  }
+  const auto pages = (size + HEADER_SIZE * 2 + PAGE_SIZE - 1) / PAGE_SIZE;
+  DEBUG_PRINT("no pre-allocated block found, allocating " << pages << " pages");
+  const auto page = getPage(pages);
+  if (page == nullptr) {
+    return nullptr;
+  }
+  const auto block = addSpan(page, pages);
+  removeFreeBlock(block);
+  return block;
+}
+
+void *MemPool::alloc(const size_t size) {
+  DEBUG_PRINT("Allocating " << size << " bytes");
+  const auto adjusted = adjustSize(size);
+  const auto block = takeBlock(adjusted);
+  if (block == nullptr) {
+    return nullptr;
+  }
+  useBlock(block, adjusted);
+  allocCount++;
+  return block->data;
+}
+
+void *MemPool::allocAligned(const size_t size, const size_t align) {
+  if ((align & (align - 1)) != 0) {
+    return nullptr;
+  }
+  if (align <= ALIGN_SIZE) {
+    return alloc(size);
+  }
+  DEBUG_PRINT("Allocating " << size << " bytes aligned to " << align);
+  const auto adjusted = adjustSize(size);
+  // enough slack to move the payload up to the next boundary and still leave a valid free block in front of it
+  auto block = takeBlock(adjusted + align + HEADER_SIZE + MIN_BLOCK_SIZE);
+  if (block == nullptr) {
+    return nullptr;
+  }
+  const auto start = reinterpret_cast<uintptr_t>(block->data);
+  auto aligned = (start + align - 1) & ~(align - 1);
+  if (aligned != start && aligned - start < HEADER_SIZE + MIN_BLOCK_SIZE) {
+    aligned = (start + HEADER_SIZE + MIN_BLOCK_SIZE + align - 1) & ~(align - 1);
+  }
+  if (aligned != start) {
+    const auto gap = aligned - start;
+    const auto alignedBlock = reinterpret_cast<MemBlock *>(aligned - HEADER_SIZE);
+    alignedBlock->header = 0;
+    setSize(alignedBlock, blockSize(block) - gap);
+    setSize(block, gap - HEADER_SIZE);
+    insertFreeBlock(block);
+    block = alignedBlock;
+  }
+  useBlock(block, adjusted);
+  allocCount++;
+  return block->data;
 }
 
 void MemPool::free(void *ptr) {
   if (ptr == nullptr) {
     return;
   }
-  if (const auto block = reinterpret_cast<MemBlock *>(static_cast<char *>(ptr) - memBlockHeaderSize);
-      block->size >= memBlockHeaderSize) {
-    DEBUG_PRINT("Freeing " << block->size << " bytes");
-    this->sizeInUse -= block->size;
-    addFreeBlock(block);
-    freeCount++;
-  }
-}
-
-void MemPool::addFreeBlock(MemBlock *block) {
-  DEBUG_PRINT("Adding " << block->size << " bytes to free list. in use: " << this->sizeInUse
-                        << " free: " << this->sizeFree);
-  bool merged;
-  MemBlock **addAt = nullptr;
-  do {
-    merged = false;
-    auto n = this->freeBlocks;
-    MemBlock *prev = nullptr;
-    addAt = &this->freeBlocks;
-    while (n) {
-      if (mergeIfPossible(&n, &block, prev)) {
-        merged = true;
-        continue;
-      }
-      if (!merged && block->size >= n->size) {
-        addAt = &n->next;
-      }
-      prev = n;
-      n = n->next;
-    }
-  } while (merged);
-  block->next = *addAt;
-  *addAt = block;
-  this->sizeFree += block->size;
+  auto block = reinterpret_cast<MemBlock *>(static_cast<char *>(ptr) - HEADER_SIZE);
+  if (isFree(block) || blockSize(block) < MIN_BLOCK_SIZE) {
+    return;
+  }
+  DEBUG_PRINT("Freeing " << blockSize(block) << " bytes");
+  sizeInUse -= blockSize(block);
+  freeCount++;
+  if (const auto next = nextBlock(block); isFree(next)) {
+    removeFreeBlock(next);
+    setSize(block, blockSize(block) + HEADER_SIZE + blockSize(next));
+  }
+  if (isPrevFree(block)) {
+    const auto prev = prevBlock(block);
+    removeFreeBlock(prev);
+    setSize(prev, blockSize(prev) + HEADER_SIZE + blockSize(block));
+    block = prev;
+  }
+  if (!releaseSpan(block)) {
+    insertFreeBlock(block);
+  }
   DEBUG_PRINT("in use: " << this->sizeInUse << " free: " << this->sizeFree);
 }
 
-bool MemPool::mergeIfPossible(MemBlock **b1, MemBlock **b2, MemBlock *prev) {
-  if (static_cast<void *>(reinterpret_cast<char *>(*b1) + (*b1)->size + memBlockHeaderSize) == *b2) {
-    const auto next = (*b1)->next;
-    removeFreeBlock(*b1, prev);
-    (*b1)->size += (*b2)->size + memBlockHeaderSize;
-    *b2 = (*b1);
-    *b1 = next;
-    return true;
+size_t MemPool::largestFreeBlock() const {
+  if (flBitmap == 0) {
+    return 0;
+  }
+  // the highest non-empty list holds the largest blocks, but its blocks are only sorted into a size range
+  const auto fl = fls(flBitmap);
+  const auto sl = fls(slBitmap[fl]);
+  size_t largest = 0;
+  for (auto block = freeBlocks[fl][sl]; block != nullptr; block = block->link.next) {
+    if (blockSize(block) > largest) {
+      largest = blockSize(block);
+    }
   }
-  if (static_cast<void *>(reinterpret_cast<char *>(*b2) + (*b2)->size + memBlockHeaderSize) == *b1) {
-    const auto next = (*b1)->next;
-    removeFreeBlock(*b1, prev);
-    (*b2)->size += (*b1)->size + memBlockHeaderSize;
-    *b1 = next;
-    return true;
+  return largest;
+}
+
+size_t MemPool::histogramBucketSize(const size_t bucket) {
+  return bucket == 0 ? 0 : static_cast<size_t>(1) << (bucket + FL_INDEX_SHIFT - 1);
+}
+
+void MemPool::writeStats(const StatsFormatter &out) const {
+  const auto largest = largestFreeBlock();
+  out.value("used", sizeInUse);
+  out.value("peak_used", peakInUse);
+  out.value("free", sizeFree);
+  out.value("pages", pageCount);
+  out.value("allocs", allocCount);
+  out.value("frees", freeCount);
+  out.value("free_blocks", freeBlockCount);
+  out.value("largest_free", largest);
+  out.value("fragmentation_permille", fragmentationPerMille(sizeFree, largest));
+  for (size_t i = 0; i < FL_INDEX_COUNT; i++) {
+    if (allocHistogram[i] != 0) {
+      out.value("alloc_hist", histogramBucketSize(i), allocHistogram[i]);
+    }
   }
-  return false;
 }
 
 MemPool defaultPool;
+Spinlock defaultPoolLock;
+
+void *kalloc(const size_t size) {
+  if (size <= SlabAllocator::MAX_SIZE) {
+    if (const auto ptr = defaultCpuCache.alloc(size); ptr != nullptr) {
+      return ptr;
+    }
+  }
+  LockGuard guard(defaultPoolLock);
+  return defaultPool.alloc(size);
+}
+
+void *kalloc_aligned(const size_t size, const size_t align) {
+  if (align <= MemPool::ALIGN_SIZE) {
+    return kalloc(size);
+  }
+  // slab objects are only guaranteed to be aligned to the smallest size class, the pool fallback of kalloc to less
+  if (align <= SlabAllocator::CLASS_SIZES[0] && size <= SlabAllocator::MAX_SIZE) {
+    if (const auto ptr = defaultCpuCache.alloc(size); ptr != nullptr) {
+      return ptr;
+    }
+  }
+  LockGuard guard(defaultPoolLock);
+  return defaultPool.allocAligned(size, align);
+}
+
+void kfree(void *ptr) {
+  if (!defaultCpuCache.free(ptr)) {
+    LockGuard guard(defaultPoolLock);
+    defaultPool.free(ptr);
+  }
+}
+
+#ifdef __KERNEL__
+void *operator new(const size_t size) {
+  const auto ptr = kalloc(size);
+  kassert(ptr != nullptr);
+  return ptr;
+}
+
+void *operator new[](const size_t size) { return operator new(size); }
+
+void *operator new(const size_t size, const std::align_val_t align) {
+  const auto ptr = kalloc_aligned(size, static_cast<size_t>(align));
+  kassert(ptr != nullptr);
+  return ptr;
+}
 
-void *kalloc(const size_t size) { return defaultPool.alloc(size); }
+void *operator new[](const size_t size, const std::align_val_t align) { return operator new(size, align); }
 
-void kfree(void *ptr) { defaultPool.free(ptr); }
+void operator delete(void *ptr) noexcept { kfree(ptr); }
+void operator delete[](void *ptr) noexcept { kfree(ptr); }
+void operator delete(void *ptr, size_t) noexcept { kfree(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { kfree(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { kfree(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { kfree(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept { kfree(ptr); }
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept { kfree(ptr); }
+#endif
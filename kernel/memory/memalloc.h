@@ -2,25 +2,45 @@
 #define MEMALLOC_H
 
 #include <cstddef>
+#include <cstdint>
 #include "get-page.h"
 
 #ifndef PAGE_SIZE
 #define PAGE_SIZE 4096
 #endif
 struct MemBlock;
+class StatsFormatter;
 
 typedef void *(*getPage_t)(size_t);
 
 typedef void (*freePage_t)(void *);
 
+// Two-level segregated fit (TLSF) allocator. Free blocks are kept on per size class lists indexed by a two-level
+// bitmap, and boundary tags let neighbouring free blocks be found and merged without walking any list, so alloc and
+// free are constant time.
 class MemPool {
 public:
+  static constexpr size_t ALIGN_SIZE_LOG2 = 3;
+  static constexpr size_t ALIGN_SIZE = 1 << ALIGN_SIZE_LOG2;
+  static constexpr size_t SL_INDEX_COUNT_LOG2 = 4;
+  static constexpr size_t SL_INDEX_COUNT = 1 << SL_INDEX_COUNT_LOG2;
+  static constexpr size_t FL_INDEX_SHIFT = SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2;
+  static constexpr size_t FL_INDEX_MAX = 40;
+  static constexpr size_t FL_INDEX_COUNT = FL_INDEX_MAX - FL_INDEX_SHIFT + 1;
+  static constexpr size_t SMALL_BLOCK_SIZE = 1 << FL_INDEX_SHIFT;
+  static constexpr size_t HEADER_SIZE = sizeof(size_t);
+  // a free block has to hold the two free list links and its footer
+  static constexpr size_t MIN_BLOCK_SIZE = sizeof(void *) * 2 + sizeof(size_t);
+  static constexpr size_t DEFAULT_RETAIN_SIZE = PAGE_SIZE * 4;
+
   MemPool() = default;
 
   [[nodiscard]] explicit MemPool(const getPage_t get_page, const freePage_t free_page) :
       getPage(get_page), freePage(free_page) {}
 
   [[nodiscard]] void *alloc(size_t size);
+  // returns nullptr if align is not a power of two
+  [[nodiscard]] void *allocAligned(size_t size, size_t align);
 
   void free(void *ptr);
 
@@ -28,28 +48,56 @@ public:
   [[nodiscard]] size_t usedSize() const { return sizeInUse; }
   [[nodiscard]] size_t countAlloc() const { return allocCount; }
   [[nodiscard]] size_t countFree() const { return freeCount; }
+  [[nodiscard]] size_t countFreeBlocks() const { return freeBlockCount; }
+  [[nodiscard]] size_t countPages() const { return pageCount; }
+  [[nodiscard]] size_t peakUsedSize() const { return peakInUse; }
+  [[nodiscard]] size_t largestFreeBlock() const;
+  // allocations per first level size class, see histogramBucketSize for the smallest size counted in a bucket
+  [[nodiscard]] size_t countAllocHistogram(const size_t bucket) const { return allocHistogram[bucket]; }
+  [[nodiscard]] static size_t histogramBucketSize(size_t bucket);
 
-protected:
-  [[nodiscard]] MemBlock *findExistingFreeBlock(size_t size);
+  void writeStats(const StatsFormatter &out) const;
 
-  void addFreeBlock(MemBlock *block);
+  // spans that become completely free are handed back to freePage once more than retain_size bytes are free
+  void setRetainSize(const size_t retain_size) { retainSize = retain_size; }
 
-  bool mergeIfPossible(MemBlock **b1, MemBlock **b2, MemBlock *prev);
-  void removeFreeBlock(MemBlock *block, MemBlock *prev);
+  // size actually reserved for a request of size bytes
+  [[nodiscard]] static size_t adjustSize(size_t size);
+
+protected:
+  [[nodiscard]] MemBlock *findFreeBlock(size_t size);
+  [[nodiscard]] MemBlock *takeBlock(size_t size);
+  [[nodiscard]] MemBlock *addSpan(void *page, size_t pages);
+  void useBlock(MemBlock *block, size_t size);
+  [[nodiscard]] bool releaseSpan(MemBlock *block);
+
+  void insertFreeBlock(MemBlock *block);
+  void removeFreeBlock(MemBlock *block);
 
   size_t sizeInUse = 0;
   size_t sizeFree = 0;
+  size_t peakInUse = 0;
   size_t allocCount = 0;
   size_t freeCount = 0;
   size_t freeBlockCount = 0;
-  MemBlock *freeBlocks = nullptr;
+  size_t pageCount = 0;
+  size_t retainSize = DEFAULT_RETAIN_SIZE;
+  uint64_t flBitmap = 0;
+  uint32_t slBitmap[FL_INDEX_COUNT] = {};
+  MemBlock *freeBlocks[FL_INDEX_COUNT][SL_INDEX_COUNT] = {};
+  size_t allocHistogram[FL_INDEX_COUNT] = {};
 
   getPage_t getPage = ::getPage;
   freePage_t freePage = ::freePage;
 };
 
+extern MemPool defaultPool;
+
 void *kalloc(size_t size);
 
+// align must be a power of two, the result is released with kfree
+void *kalloc_aligned(size_t size, size_t align);
+
 void kfree(void *ptr);
 
 #endif // MEMALLOC_H
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_set>
+#include <vector>
+#include "AllocatorStats.h"
+#include "memalloc.h"
+
+void *getPage(const size_t) { return nullptr; }
+
+void freePage(void *) {}
+
+namespace {
+  std::unordered_set<void *> spans;
+
+  void *allocPages(const size_t count) {
+    const auto ptr = aligned_alloc(PAGE_SIZE, count * PAGE_SIZE);
+    spans.insert(ptr);
+    return ptr;
+  }
+
+  void freePages(void *ptr) {
+    spans.erase(ptr);
+    free(ptr);
+  }
+
+  // MemPool has no destructor that returns its spans, so drop everything between runs
+  void releaseSpans() {
+    for (const auto span: spans) {
+      free(span);
+    }
+    spans.clear();
+  }
+
+  struct Op {
+    bool alloc;
+    uint32_t slot;
+    uint32_t size;
+  };
+
+  struct Trace {
+    std::vector<Op> ops;
+    size_t slots = 0;
+  };
+
+  // deterministic so every run and every build replays exactly the same trace
+  class Random {
+  public:
+    explicit Random(const uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      return state;
+    }
+
+    uint32_t range(const uint32_t low, const uint32_t high) { return low + next() % (high - low + 1); }
+
+  private:
+    uint64_t state;
+  };
+
+  uint32_t kernelObjectSize(Random &random) {
+    const auto pick = random.next() % 100;
+    if (pick < 70) {
+      return random.range(8, 256);
+    }
+    if (pick < 95) {
+      return random.range(257, 2048);
+    }
+    return random.range(2049, PAGE_SIZE * 4);
+  }
+
+  // bursts of small objects that are all released together, like a request being processed and torn down
+  Trace burstySmall() {
+    Trace trace;
+    Random random(1);
+    constexpr uint32_t burst = 512;
+    trace.slots = burst;
+    std::vector<uint32_t> order(burst);
+    for (int round = 0; round < 32; round++) {
+      const auto count = random.range(burst / 4, burst);
+      for (uint32_t i = 0; i < count; i++) {
+        trace.ops.push_back({true, i, random.range(8, 192)});
+        order[i] = i;
+      }
+      for (uint32_t i = count - 1; i > 0; i--) {
+        std::swap(order[i], order[random.next() % (i + 1)]);
+      }
+      for (uint32_t i = 0; i < count; i++) {
+        trace.ops.push_back({false, order[i], 0});
+      }
+    }
+    return trace;
+  }
+
+  // a working set of objects with random lifetimes and a realistic size mix
+  Trace mixedLifetimes() {
+    Trace trace;
+    Random random(2);
+    constexpr uint32_t slots = 2048;
+    trace.slots = slots;
+    std::vector<bool> live(slots);
+    for (int i = 0; i < 50000; i++) {
+      const auto slot = static_cast<uint32_t>(random.next() % slots);
+      if (live[slot]) {
+        trace.ops.push_back({false, slot, 0});
+      } else {
+        trace.ops.push_back({true, slot, kernelObjectSize(random)});
+      }
+      live[slot] = !live[slot];
+    }
+    for (uint32_t slot = 0; slot < slots; slot++) {
+      if (live[slot]) {
+        trace.ops.push_back({false, slot, 0});
+      }
+    }
+    return trace;
+  }
+
+  // page multiple buffers interleaved with the small allocations that describe them
+  Trace largePages() {
+    Trace trace;
+    Random random(3);
+    constexpr uint32_t slots = 128;
+    trace.slots = slots * 2;
+    std::vector<bool> live(slots);
+    for (int i = 0; i < 5000; i++) {
+      const auto slot = static_cast<uint32_t>(random.next() % slots);
+      if (live[slot]) {
+        trace.ops.push_back({false, slot * 2, 0});
+        trace.ops.push_back({false, slot * 2 + 1, 0});
+      } else {
+        trace.ops.push_back({true, slot * 2, random.range(1, 8) * PAGE_SIZE});
+        trace.ops.push_back({true, slot * 2 + 1, random.range(32, 128)});
+      }
+      live[slot] = !live[slot];
+    }
+    for (uint32_t slot = 0; slot < slots; slot++) {
+      if (live[slot]) {
+        trace.ops.push_back({false, slot * 2, 0});
+        trace.ops.push_back({false, slot * 2 + 1, 0});
+      }
+    }
+    return trace;
+  }
+
+  void replay(benchmark::State &state, const Trace &trace) {
+    std::vector<void *> slots(trace.slots);
+    std::vector<uint32_t> latencies(trace.ops.size());
+    std::vector<uint32_t> allLatencies;
+    uint64_t totalLatency = 0;
+    size_t peakUsed = 0;
+    size_t peakPages = 0;
+    uint64_t fragmentationSum = 0;
+    uint64_t fragmentationSamples = 0;
+    for (auto _: state) {
+      MemPool pool(allocPages, freePages);
+      for (size_t i = 0; i < trace.ops.size(); i++) {
+        const auto &op = trace.ops[i];
+        const auto start = std::chrono::steady_clock::now();
+        if (op.alloc) {
+          slots[op.slot] = pool.alloc(op.size);
+        } else {
+          pool.free(slots[op.slot]);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        if (op.alloc && pool.countPages() > peakPages) {
+          peakPages = pool.countPages();
+        }
+        // sample while the working set is live, once everything is freed the number means nothing
+        if (i % 1024 == 1023) {
+          fragmentationSum += fragmentationPerMille(pool.freeSize(), pool.largestFreeBlock());
+          fragmentationSamples++;
+        }
+      }
+      benchmark::DoNotOptimize(slots.data());
+      state.PauseTiming();
+      peakUsed = std::max(peakUsed, pool.peakUsedSize());
+      allLatencies.insert(allLatencies.end(), latencies.begin(), latencies.end());
+      for (const auto latency: latencies) {
+        totalLatency += latency;
+      }
+      releaseSpans();
+      state.ResumeTiming();
+    }
+    const auto p99 = allLatencies.begin() + allLatencies.size() * 99 / 100;
+    std::nth_element(allLatencies.begin(), p99, allLatencies.end());
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * trace.ops.size()));
+    state.counters["ns_per_op"] = static_cast<double>(totalLatency) / static_cast<double>(allLatencies.size());
+    state.counters["p99_ns"] = *p99;
+    state.counters["peak_used"] = static_cast<double>(peakUsed);
+    state.counters["peak_pages"] = static_cast<double>(peakPages);
+    state.counters["fragmentation_permille"] =
+        static_cast<double>(fragmentationSum) / static_cast<double>(std::max<uint64_t>(fragmentationSamples, 1));
+  }
+
+  void BM_BurstySmall(benchmark::State &state) { replay(state, burstySmall()); }
+  void BM_MixedLifetimes(benchmark::State &state) { replay(state, mixedLifetimes()); }
+  void BM_LargePages(benchmark::State &state) { replay(state, largePages()); }
+} // namespace
+
+BENCHMARK(BM_BurstySmall);
+BENCHMARK(BM_MixedLifetimes);
+BENCHMARK(BM_LargePages);
@@ -1,25 +1,39 @@
 #include "memalloc.h"
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <gtest/gtest.h>
 #include <list>
+#include <string>
+#include <vector>
+#include "AllocatorStats.h"
+#include "BuddyAllocator.h"
+#include "ObjectPool.h"
+#include "PerCpuCache.h"
+#include "SlabAllocator.h"
 
-void *getPage(const size_t) { return nullptr; }
+// backs the default allocators behind kalloc
+void *getPage(const size_t count) { return aligned_alloc(PAGE_SIZE, count * PAGE_SIZE); }
 
-void freePage(void *) {}
+void freePage(void *ptr) { free(ptr); }
 
 class MemPoolTest : public testing::Test {
 protected:
   static std::list<void *> pages;
   MemPool *pool = nullptr;
 
-  void SetUp() override {
-    pool = new MemPool([](const size_t count) { return pages.emplace_back(malloc(count * PAGE_SIZE)); },
-                       [](void *p) {
-                         pages.remove_if([p](const void *page) { return page == p; });
-                         free(p);
-                       });
+  static void *allocPages(const size_t count) {
+    return pages.emplace_back(aligned_alloc(PAGE_SIZE, count * PAGE_SIZE));
+  }
+
+  static void freePages(void *p) {
+    pages.remove_if([p](const void *page) { return page == p; });
+    free(p);
   }
 
+  void SetUp() override { pool = new MemPool(allocPages, freePages); }
+
   void TearDown() override {
     delete pool;
     for (const auto page: pages) {
@@ -32,50 +46,615 @@ protected:
 std::list<void *> MemPoolTest::pages;
 
 TEST_F(MemPoolTest, SingleAlloc) {
+  const auto a10 = MemPool::adjustSize(10);
   EXPECT_EQ(pool->usedSize(), 0) << "initial used";
   EXPECT_EQ(pool->freeSize(), 0) << "initial free";
   void *ptr = pool->alloc(10);
   EXPECT_NE(ptr, nullptr);
-  EXPECT_EQ(pool->usedSize(), 10) << "used after alloc";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 2 - 10) << "free after alloc";
+  EXPECT_EQ(pool->usedSize(), a10) << "used after alloc";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 3 - a10) << "free after alloc";
   pool->free(ptr);
   EXPECT_EQ(pool->usedSize(), 0) << "use after free";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t)) << "free after free";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 2) << "free after free";
 }
 
 TEST_F(MemPoolTest, MultipleAlloc) {
+  const auto a9 = MemPool::adjustSize(9);
+  const auto a10 = MemPool::adjustSize(10);
+  const auto a11 = MemPool::adjustSize(11);
   EXPECT_EQ(pool->usedSize(), 0) << "initial used";
   EXPECT_EQ(pool->freeSize(), 0) << "initial free";
   EXPECT_EQ(pool->countAlloc(), 0);
   EXPECT_EQ(pool->countFree(), 0);
   void *ptr1 = pool->alloc(10);
   EXPECT_NE(ptr1, nullptr);
-  EXPECT_EQ(pool->usedSize(), 10) << "used after 1st alloc";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 2 - 10) << "free after 1st alloc";
+  EXPECT_EQ(pool->usedSize(), a10) << "used after 1st alloc";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 3 - a10) << "free after 1st alloc";
   EXPECT_EQ(pool->countAlloc(), 1);
   void *ptr2 = pool->alloc(9);
   EXPECT_NE(ptr2, nullptr);
   EXPECT_NE(ptr1, ptr2);
-  EXPECT_EQ(pool->usedSize(), 10 + 9) << "used after 2nd alloc";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 3 - 10 - 9) << "free after 2nd alloc";
+  EXPECT_EQ(pool->usedSize(), a10 + a9) << "used after 2nd alloc";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 4 - a10 - a9) << "free after 2nd alloc";
   EXPECT_EQ(pool->countAlloc(), 2);
   void *ptr3 = pool->alloc(11);
   EXPECT_NE(ptr3, nullptr);
   EXPECT_NE(ptr3, ptr1);
   EXPECT_NE(ptr3, ptr2);
-  EXPECT_EQ(pool->usedSize(), 10 + 9 + 11) << "used after 3rd alloc";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 4 - 10 - 9 - 11) << "free after 3rd alloc";
+  EXPECT_EQ(pool->usedSize(), a10 + a9 + a11) << "used after 3rd alloc";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 5 - a10 - a9 - a11) << "free after 3rd alloc";
   EXPECT_EQ(pool->countAlloc(), 3);
   pool->free(ptr3);
-  EXPECT_EQ(pool->usedSize(), 10 + 9) << "used after 1st free";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 3 - 10 - 9) << "free after 1st free";
+  EXPECT_EQ(pool->usedSize(), a10 + a9) << "used after 1st free";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 4 - a10 - a9) << "free after 1st free";
   EXPECT_EQ(pool->countFree(), 1);
   pool->free(ptr1);
-  EXPECT_EQ(pool->usedSize(), 9) << "used after 2nd free";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 3 - 9) << "free after 2nd free";
+  EXPECT_EQ(pool->usedSize(), a9) << "used after 2nd free";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 4 - a9) << "free after 2nd free";
   EXPECT_EQ(pool->countFree(), 2);
   pool->free(ptr2);
   EXPECT_EQ(pool->usedSize(), 0) << "use after 3rd free";
-  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t)) << "free after 3rd free";
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 2) << "free after 3rd free";
   EXPECT_EQ(pool->countFree(), 3);
 }
+
+TEST_F(MemPoolTest, CoalescesNeighbours) {
+  void *ptrs[32];
+  for (auto &ptr: ptrs) {
+    ptr = pool->alloc(64);
+    ASSERT_NE(ptr, nullptr);
+  }
+  EXPECT_EQ(pool->countFreeBlocks(), 1);
+  for (size_t i = 0; i < std::size(ptrs); i += 2) {
+    pool->free(ptrs[i]);
+  }
+  EXPECT_EQ(pool->countFreeBlocks(), std::size(ptrs) / 2 + 1);
+  void *reused = pool->alloc(64);
+  EXPECT_NE(std::find(std::begin(ptrs), std::end(ptrs), reused), std::end(ptrs)) << "freed block is reused";
+  EXPECT_EQ(pool->countFreeBlocks(), std::size(ptrs) / 2);
+  for (size_t i = 1; i < std::size(ptrs); i += 2) {
+    pool->free(ptrs[i]);
+  }
+  pool->free(reused);
+  EXPECT_EQ(pool->countFreeBlocks(), 1);
+  EXPECT_EQ(pool->usedSize(), 0);
+  EXPECT_EQ(pool->freeSize(), PAGE_SIZE - sizeof(size_t) * 2);
+}
+
+TEST_F(MemPoolTest, LargeAlloc) {
+  void *ptr = pool->alloc(PAGE_SIZE * 3);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % MemPool::ALIGN_SIZE, 0);
+  EXPECT_EQ(pages.size(), 1);
+  memset(ptr, 0xAA, PAGE_SIZE * 3);
+  void *small = pool->alloc(100);
+  EXPECT_NE(small, nullptr);
+  pool->free(ptr);
+  pool->free(small);
+  EXPECT_EQ(pool->usedSize(), 0);
+  EXPECT_EQ(pool->countFreeBlocks(), 1);
+}
+
+TEST_F(MemPoolTest, ReleasesFreeSpans) {
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < 64; i++) {
+    ptrs.push_back(pool->alloc(1000));
+    ASSERT_NE(ptrs.back(), nullptr);
+  }
+  const auto peak = pages.size();
+  EXPECT_GT(peak, MemPool::DEFAULT_RETAIN_SIZE / PAGE_SIZE);
+  EXPECT_EQ(pool->countPages(), peak);
+  for (const auto ptr: ptrs) {
+    pool->free(ptr);
+  }
+  EXPECT_LT(pages.size(), peak);
+  EXPECT_LE(pages.size(), MemPool::DEFAULT_RETAIN_SIZE / PAGE_SIZE + 1);
+  EXPECT_EQ(pool->countPages(), pages.size());
+  EXPECT_EQ(pool->usedSize(), 0);
+  EXPECT_EQ(pool->freeSize(), pages.size() * (PAGE_SIZE - sizeof(size_t) * 2));
+}
+
+TEST_F(MemPoolTest, RetainSizeLimitsCachedSpans) {
+  pool->setRetainSize(0);
+  void *ptr = pool->alloc(100);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(pages.size(), 1);
+  pool->free(ptr);
+  EXPECT_EQ(pages.size(), 0);
+  EXPECT_EQ(pool->freeSize(), 0);
+
+  pool->setRetainSize(PAGE_SIZE * 16);
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < 64; i++) {
+    ptrs.push_back(pool->alloc(2000));
+  }
+  const auto peak = pages.size();
+  for (const auto p: ptrs) {
+    pool->free(p);
+  }
+  EXPECT_LT(pages.size(), peak);
+  EXPECT_GE(pages.size(), 15) << "spans below the retain size are kept";
+  EXPECT_LE(pool->freeSize(), PAGE_SIZE * 16);
+}
+
+TEST_F(MemPoolTest, AlignedAlloc) {
+  std::vector<void *> ptrs;
+  for (const size_t align: {16, 64, 256, 4096}) {
+    for (const size_t size: {1, 100, 4096}) {
+      void *ptr = pool->allocAligned(size, align);
+      ASSERT_NE(ptr, nullptr) << size << "/" << align;
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % align, 0) << size << "/" << align;
+      memset(ptr, 0x55, size);
+      ptrs.push_back(ptr);
+    }
+  }
+  EXPECT_EQ(pool->allocAligned(10, 24), nullptr);
+  for (const auto ptr: ptrs) {
+    pool->free(ptr);
+  }
+  EXPECT_EQ(pool->usedSize(), 0);
+  EXPECT_EQ(pool->countFreeBlocks(), pages.size()) << "gaps merge back into their span";
+}
+
+std::string statsOutput;
+
+void captureStats(const char *text, const size_t length) { statsOutput.append(text, length); }
+
+bool hasStat(const std::string &line) { return statsOutput.find("\n" + line + "\n") != std::string::npos; }
+
+TEST_F(MemPoolTest, Stats) {
+  void *ptrs[8];
+  for (size_t i = 0; i < std::size(ptrs); i++) {
+    ptrs[i] = pool->alloc(i < 6 ? 40 : 1000);
+  }
+  const auto peak = pool->usedSize();
+  for (size_t i = 0; i < std::size(ptrs); i += 2) {
+    pool->free(ptrs[i]);
+  }
+  EXPECT_EQ(pool->peakUsedSize(), peak);
+  EXPECT_EQ(pool->countAllocHistogram(0), 6);
+  EXPECT_EQ(pool->countAllocHistogram(3), 2) << "1000 bytes is in the 512-1023 bucket";
+  EXPECT_EQ(MemPool::histogramBucketSize(3), 512);
+  EXPECT_LT(pool->largestFreeBlock(), pool->freeSize());
+  EXPECT_GT(pool->largestFreeBlock(), 1000);
+
+  statsOutput = "\n";
+  pool->writeStats(StatsFormatter(captureStats, "pool"));
+  EXPECT_TRUE(hasStat("pool.used=" + std::to_string(pool->usedSize()))) << statsOutput;
+  EXPECT_TRUE(hasStat("pool.peak_used=" + std::to_string(peak))) << statsOutput;
+  EXPECT_TRUE(hasStat("pool.free_blocks=" + std::to_string(pool->countFreeBlocks()))) << statsOutput;
+  EXPECT_TRUE(hasStat("pool.largest_free=" + std::to_string(pool->largestFreeBlock()))) << statsOutput;
+  EXPECT_TRUE(hasStat("pool.alloc_hist.0=6")) << statsOutput;
+  EXPECT_TRUE(hasStat("pool.alloc_hist.512=2")) << statsOutput;
+  EXPECT_TRUE(hasStat("pool.fragmentation_permille=" +
+                      std::to_string(fragmentationPerMille(pool->freeSize(), pool->largestFreeBlock()))))
+      << statsOutput;
+  for (size_t start = 1; start < statsOutput.size();) {
+    const auto end = statsOutput.find('\n', start);
+    const auto line = statsOutput.substr(start, end - start);
+    EXPECT_EQ(std::count(line.begin(), line.end(), '='), 1) << line;
+    start = end + 1;
+  }
+}
+
+TEST(AllocatorStats, Fragmentation) {
+  EXPECT_EQ(fragmentationPerMille(0, 0), 0);
+  EXPECT_EQ(fragmentationPerMille(1000, 1000), 0);
+  EXPECT_EQ(fragmentationPerMille(1000, 250), 750);
+}
+
+TEST(AllocatorStats, DefaultAllocators) {
+  statsOutput = "\n";
+  writeAllocatorStats(captureStats);
+  EXPECT_EQ(statsOutput.find("\nalloc.begin\n"), 0);
+  EXPECT_TRUE(hasStat("pool.used=0")) << statsOutput;
+  EXPECT_TRUE(hasStat("slab.used=0")) << statsOutput;
+  EXPECT_TRUE(hasStat("frames.free_pages=0")) << statsOutput;
+  EXPECT_EQ(statsOutput.substr(statsOutput.size() - 10), "alloc.end\n");
+}
+
+TEST(Kalloc, AlignedAllocationsAboveTheSlabSizes) {
+  std::vector<void *> ptrs;
+  // sizes that leave the pool's blocks at every 8 byte offset
+  for (size_t i = 0; i < 16; i++) {
+    for (const size_t size: {SlabAllocator::MAX_SIZE + 8 * i + 8, SlabAllocator::MAX_SIZE + 8 * i + 1000}) {
+      const auto ptr = kalloc_aligned(size, 16);
+      ASSERT_NE(ptr, nullptr);
+      EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % 16, 0) << size;
+      ptrs.push_back(ptr);
+    }
+  }
+  const auto small = kalloc_aligned(24, 16);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(small) % 16, 0);
+  kfree(small);
+  for (const auto ptr: ptrs) {
+    kfree(ptr);
+  }
+}
+
+struct PoolObject {
+  static size_t live;
+  uint64_t value;
+  uint8_t tag;
+
+  PoolObject(const uint64_t value, const uint8_t tag) : value(value), tag(tag) { live++; }
+  ~PoolObject() { live--; }
+};
+
+size_t PoolObject::live = 0;
+
+struct alignas(256) AlignedPoolObject {
+  char data[300];
+};
+
+TEST_F(MemPoolTest, ObjectPool) {
+  ObjectPool<PoolObject> objects(allocPages);
+  EXPECT_EQ(ObjectPool<PoolObject>::OBJECT_SIZE, 16);
+  std::vector<PoolObject *> created;
+  for (uint64_t i = 0; i < PAGE_SIZE / 16 + 1; i++) {
+    const auto object = objects.create(i, static_cast<uint8_t>(i));
+    ASSERT_NE(object, nullptr);
+    EXPECT_EQ(object->value, i);
+    created.push_back(object);
+  }
+  EXPECT_EQ(PoolObject::live, created.size());
+  EXPECT_EQ(objects.countPages(), 2);
+  EXPECT_EQ(pages.size(), 2);
+  const auto last = created.back();
+  objects.destroy(last);
+  EXPECT_EQ(PoolObject::live, created.size() - 1);
+  EXPECT_EQ(objects.create(1, 2), last) << "freed slot is reused first";
+  for (const auto object: created) {
+    objects.destroy(object);
+  }
+  EXPECT_EQ(PoolObject::live, 0);
+  EXPECT_EQ(objects.countAlloc(), objects.countFree());
+  EXPECT_EQ(objects.countPages(), 2);
+
+  ObjectPool<AlignedPoolObject> aligned(allocPages);
+  EXPECT_EQ(ObjectPool<AlignedPoolObject>::OBJECT_SIZE, 512);
+  for (size_t i = 0; i < 10; i++) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned.alloc()) % 256, 0);
+  }
+}
+
+class SlabAllocatorTest : public MemPoolTest {
+protected:
+  SlabAllocator *slab = nullptr;
+
+  void SetUp() override {
+    MemPoolTest::SetUp();
+    slab = new SlabAllocator(allocPages, freePages);
+  }
+
+  void TearDown() override {
+    delete slab;
+    MemPoolTest::TearDown();
+  }
+
+  // mix of sizes typical for kernel objects, all within the slab range
+  static size_t traceSize(const size_t i) {
+    static constexpr size_t sizes[] = {8, 24, 40, 64, 16, 100, 200, 32, 512, 48};
+    return sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+  }
+
+  template<typename Alloc, typename Free>
+  static long long timeAllocFree(const size_t count, Alloc alloc, Free release) {
+    std::vector<void *> ptrs(count);
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < 10; round++) {
+      for (size_t i = 0; i < count; i++) {
+        ptrs[i] = alloc(traceSize(i));
+      }
+      for (size_t i = 0; i < count; i++) {
+        release(ptrs[i]);
+      }
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+TEST_F(SlabAllocatorTest, SizeClasses) {
+  for (const size_t size: {1ul, 16ul, 17ul, 100ul, 129ul, 1000ul, SlabAllocator::MAX_SIZE}) {
+    void *ptr = slab->alloc(size);
+    ASSERT_NE(ptr, nullptr) << size;
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % 16, 0) << size;
+    EXPECT_GE(slab->usedSize(), size) << size;
+    EXPECT_EQ(slab->usedSize(), SlabAllocator::CLASS_SIZES[SlabAllocator::sizeClassIndex(size)]) << size;
+    EXPECT_TRUE(slab->free(ptr)) << size;
+    EXPECT_EQ(slab->usedSize(), 0) << size;
+  }
+  EXPECT_EQ(slab->alloc(SlabAllocator::MAX_SIZE + 1), nullptr);
+  EXPECT_EQ(slab->countAlloc(), slab->countFree());
+  EXPECT_EQ(slab->countClassAlloc(0), 2) << "1 and 16 bytes share the smallest class";
+  EXPECT_EQ(slab->countClassInUse(0), 0);
+  EXPECT_EQ(slab->peakUsedSize(), SlabAllocator::MAX_SIZE);
+}
+
+TEST_F(SlabAllocatorTest, ReusesFreedObjects) {
+  void *ptr1 = slab->alloc(40);
+  void *ptr2 = slab->alloc(40);
+  EXPECT_NE(ptr1, ptr2);
+  EXPECT_TRUE(slab->free(ptr1));
+  EXPECT_EQ(slab->alloc(33), ptr1);
+  EXPECT_EQ(slab->countPages(), 1);
+}
+
+TEST_F(SlabAllocatorTest, ReleasesEmptyPages) {
+  constexpr auto perPage = (PAGE_SIZE - SlabAllocator::HEADER_SIZE) / 64;
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < perPage * 3; i++) {
+    ptrs.push_back(slab->alloc(64));
+  }
+  EXPECT_EQ(slab->countPages(), 3);
+  EXPECT_EQ(pages.size(), 3);
+  for (const auto ptr: ptrs) {
+    EXPECT_TRUE(slab->free(ptr));
+  }
+  EXPECT_EQ(slab->countPages(), 1) << "one empty page is kept as a spare";
+  EXPECT_EQ(pages.size(), 1);
+}
+
+TEST_F(SlabAllocatorTest, RejectsForeignPointers) {
+  void *ptr = pool->alloc(100);
+  EXPECT_FALSE(SlabAllocator::isSlabObject(ptr));
+  EXPECT_FALSE(slab->free(ptr));
+  pool->free(ptr);
+  EXPECT_TRUE(slab->free(nullptr));
+}
+
+TEST_F(SlabAllocatorTest, Throughput) {
+  constexpr size_t count = 1000;
+  const auto slabTime = timeAllocFree(count, [this](const size_t size) { return slab->alloc(size); },
+                                      [this](void *p) { slab->free(p); });
+  const auto poolTime = timeAllocFree(count, [this](const size_t size) { return pool->alloc(size); },
+                                      [this](void *p) { pool->free(p); });
+  RecordProperty("slab_ns_per_op", static_cast<int>(slabTime / (count * 10)));
+  RecordProperty("pool_ns_per_op", static_cast<int>(poolTime / (count * 10)));
+  EXPECT_EQ(slab->usedSize(), 0);
+  EXPECT_EQ(pool->usedSize(), 0);
+  EXPECT_EQ(slab->countAlloc(), count * 10);
+  EXPECT_EQ(slab->countFree(), count * 10);
+}
+
+TEST_F(SlabAllocatorTest, Fragmentation) {
+  constexpr size_t count = 1000;
+  std::vector<void *> slabPtrs(count);
+  std::vector<void *> poolPtrs(count);
+  for (size_t i = 0; i < count; i++) {
+    slabPtrs[i] = slab->alloc(traceSize(i));
+    poolPtrs[i] = pool->alloc(traceSize(i));
+  }
+  // free every third object, leaving holes in every size class, then refill the holes with the same mix
+  for (size_t i = 0; i < count; i += 3) {
+    slab->free(slabPtrs[i]);
+    pool->free(poolPtrs[i]);
+  }
+  const auto slabPages = slab->countPages();
+  for (size_t i = 0; i < count; i += 3) {
+    slabPtrs[i] = slab->alloc(traceSize(i));
+    poolPtrs[i] = pool->alloc(traceSize(i));
+  }
+  EXPECT_EQ(slab->countPages(), slabPages) << "holes are refilled without new pages";
+  RecordProperty("slab_bytes_per_used_byte_x100",
+                 static_cast<int>(slab->countPages() * PAGE_SIZE * 100 / slab->usedSize()));
+  RecordProperty("pool_bytes_per_used_byte_x100",
+                 static_cast<int>((pool->usedSize() + pool->freeSize()) * 100 / pool->usedSize()));
+  for (size_t i = 0; i < count; i++) {
+    EXPECT_TRUE(slab->free(slabPtrs[i]));
+    pool->free(poolPtrs[i]);
+  }
+  EXPECT_EQ(slab->usedSize(), 0);
+  EXPECT_EQ(pool->usedSize(), 0);
+}
+
+class PerCpuCacheTest : public SlabAllocatorTest {
+protected:
+  static size_t currentCpu;
+  PerCpuCache *cache = nullptr;
+
+  void SetUp() override {
+    SlabAllocatorTest::SetUp();
+    currentCpu = 0;
+    cache = new PerCpuCache(slab, [] { return currentCpu; });
+  }
+
+  void TearDown() override {
+    delete cache;
+    SlabAllocatorTest::TearDown();
+  }
+};
+
+size_t PerCpuCacheTest::currentCpu;
+
+TEST_F(PerCpuCacheTest, CountersArePerCpu) {
+  void *ptr1 = cache->alloc(32);
+  void *ptr2 = cache->alloc(32);
+  currentCpu = 1;
+  void *ptr3 = cache->alloc(100);
+  EXPECT_TRUE(cache->free(ptr3));
+  EXPECT_TRUE(cache->free(ptr1));
+  EXPECT_EQ(cache->countAlloc(0), 2);
+  EXPECT_EQ(cache->countFree(0), 0);
+  EXPECT_EQ(cache->countAlloc(1), 1);
+  EXPECT_EQ(cache->countFree(1), 2);
+  currentCpu = 0;
+  EXPECT_TRUE(cache->free(ptr2));
+  EXPECT_EQ(cache->countFree(0), 1);
+  EXPECT_FALSE(cache->free(pool->alloc(10)));
+}
+
+TEST_F(PerCpuCacheTest, RefillsInBatches) {
+  void *ptr = cache->alloc(64);
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_EQ(cache->countRefill(0), 1);
+  // one magazine plus half a magazine of objects
+  EXPECT_EQ(slab->countAlloc(), 1 + PerCpuCache::MAGAZINE_SIZE / 2);
+  const auto slabAllocs = slab->countAlloc();
+  std::vector<void *> ptrs;
+  for (size_t i = 1; i < PerCpuCache::MAGAZINE_SIZE / 2; i++) {
+    ptrs.push_back(cache->alloc(64));
+  }
+  EXPECT_EQ(slab->countAlloc(), slabAllocs) << "served from the loaded magazine";
+  EXPECT_EQ(cache->countRefill(0), 1);
+  EXPECT_TRUE(cache->free(ptr));
+  EXPECT_EQ(cache->alloc(50), ptr) << "freed objects are reused by the same cpu";
+  EXPECT_EQ(slab->countAlloc(), slabAllocs);
+}
+
+TEST_F(PerCpuCacheTest, MagazinesMoveBetweenCpusThroughDepot) {
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < PerCpuCache::MAGAZINE_SIZE * 4; i++) {
+    ptrs.push_back(cache->alloc(128));
+  }
+  for (const auto ptr: ptrs) {
+    EXPECT_TRUE(cache->free(ptr));
+  }
+  EXPECT_GT(cache->countFlush(0), 0);
+  const auto slabAllocs = slab->countAlloc();
+  currentCpu = 1;
+  for (size_t i = 0; i < PerCpuCache::MAGAZINE_SIZE; i++) {
+    EXPECT_NE(cache->alloc(128), nullptr);
+  }
+  EXPECT_EQ(slab->countAlloc(), slabAllocs) << "cpu 1 was refilled with full magazines freed by cpu 0";
+  EXPECT_EQ(cache->countRefill(1), 1);
+}
+
+TEST_F(PerCpuCacheTest, FlushReturnsEverythingToSlab) {
+  std::vector<void *> ptrs;
+  for (size_t i = 0; i < 500; i++) {
+    currentCpu = i % 3;
+    ptrs.push_back(cache->alloc(traceSize(i)));
+  }
+  for (size_t i = 0; i < ptrs.size(); i++) {
+    currentCpu = (i + 1) % 3;
+    EXPECT_TRUE(cache->free(ptrs[i]));
+  }
+  EXPECT_GT(slab->usedSize(), 0) << "objects are still cached";
+  for (size_t cpu = 0; cpu < 3; cpu++) {
+    cache->flush(cpu);
+  }
+  EXPECT_EQ(slab->usedSize(), 0);
+  EXPECT_EQ(slab->countAlloc(), slab->countFree());
+}
+
+class BuddyAllocatorTest : public testing::Test {
+protected:
+  static constexpr uint64_t MiB = 1024 * 1024;
+  static constexpr uint64_t GiB = 1024 * MiB;
+  std::vector<char> metadata;
+  memory::BuddyAllocator buddy;
+
+  void init(const uint64_t start, const uint64_t end) {
+    metadata.resize(memory::BuddyAllocator::metadataSize(start, end));
+    buddy.init(start, end, metadata.data(), 0);
+  }
+};
+
+TEST_F(BuddyAllocatorTest, AllocatesAlignedRuns) {
+  init(0, 4 * MiB);
+  buddy.addRange(0, 4 * MiB);
+  EXPECT_EQ(buddy.freePages(), 1024);
+  const auto page = buddy.alloc(1);
+  ASSERT_NE(page, memory::BuddyAllocator::NO_PAGE);
+  EXPECT_EQ(page % PAGE_SIZE, 0);
+  const auto large = buddy.allocOrder(memory::BuddyAllocator::ORDER_2M);
+  ASSERT_NE(large, memory::BuddyAllocator::NO_PAGE);
+  EXPECT_EQ(large % (2 * MiB), 0);
+  EXPECT_EQ(buddy.allocOrder(memory::BuddyAllocator::ORDER_2M), memory::BuddyAllocator::NO_PAGE)
+      << "the other 2 MiB block has been split";
+  const auto three = buddy.alloc(3);
+  EXPECT_EQ(three % (4 * PAGE_SIZE), 0) << "rounded up to an order 2 block";
+  EXPECT_EQ(buddy.freePages(), 1024 - 1 - 512 - 4);
+}
+
+TEST_F(BuddyAllocatorTest, CoalescesOnFree) {
+  init(0, 2 * MiB);
+  buddy.addRange(0, 2 * MiB);
+  EXPECT_EQ(buddy.countFreeBlocks(memory::BuddyAllocator::ORDER_2M), 1);
+  std::vector<uint64_t> pages;
+  for (int i = 0; i < 512; i++) {
+    pages.push_back(buddy.alloc(1));
+    ASSERT_NE(pages.back(), memory::BuddyAllocator::NO_PAGE);
+  }
+  EXPECT_EQ(buddy.alloc(1), memory::BuddyAllocator::NO_PAGE);
+  EXPECT_EQ(buddy.freePages(), 0);
+  for (size_t i = 0; i < pages.size(); i += 2) {
+    buddy.free(pages[i]);
+  }
+  EXPECT_EQ(buddy.countFreeBlocks(0), 256) << "no buddies are free yet";
+  for (size_t i = 1; i < pages.size(); i += 2) {
+    buddy.free(pages[i]);
+  }
+  EXPECT_EQ(buddy.countFreeBlocks(0), 0);
+  EXPECT_EQ(buddy.countFreeBlocks(memory::BuddyAllocator::ORDER_2M), 1);
+  EXPECT_EQ(buddy.freePages(), 512);
+}
+
+TEST_F(BuddyAllocatorTest, SkipsHolesAndUnalignedEdges) {
+  init(GiB, GiB + 64 * MiB);
+  buddy.addRange(GiB + 100, 8 * MiB);
+  buddy.addRange(GiB + 32 * MiB, 16 * MiB);
+  EXPECT_EQ(buddy.totalPages(), (8 * MiB - PAGE_SIZE) / PAGE_SIZE + 16 * MiB / PAGE_SIZE);
+  size_t count = 0;
+  for (auto page = buddy.alloc(1); page != memory::BuddyAllocator::NO_PAGE; page = buddy.alloc(1)) {
+    const auto inFirst = page >= GiB + PAGE_SIZE && page < GiB + 8 * MiB;
+    const auto inSecond = page >= GiB + 32 * MiB && page < GiB + 48 * MiB;
+    EXPECT_TRUE(inFirst || inSecond) << std::hex << page;
+    count++;
+  }
+  EXPECT_EQ(count, buddy.totalPages());
+}
+
+TEST_F(BuddyAllocatorTest, HandsOutGigabytePages) {
+  init(0, 2 * GiB);
+  buddy.addRange(16 * MiB, 2 * GiB - 16 * MiB);
+  const auto page = buddy.allocOrder(memory::BuddyAllocator::ORDER_1G);
+  EXPECT_EQ(page, GiB) << "the first GiB is not completely usable";
+  buddy.free(page);
+  EXPECT_EQ(buddy.countFreeBlocks(memory::BuddyAllocator::ORDER_1G), 1);
+  EXPECT_EQ(buddy.allocOrder(memory::BuddyAllocator::MAX_ORDER + 1), memory::BuddyAllocator::NO_PAGE);
+}
+
+TEST_F(BuddyAllocatorTest, SharedBlocksNeedEveryReferenceFreed) {
+  init(0, 4 * MiB);
+  buddy.addRange(0, 4 * MiB);
+  const auto page = buddy.alloc(1);
+  EXPECT_EQ(buddy.countShares(page), 0);
+  EXPECT_TRUE(buddy.share(page));
+  EXPECT_TRUE(buddy.share(page));
+  EXPECT_FALSE(buddy.share(page + PAGE_SIZE)) << "not allocated";
+  EXPECT_EQ(buddy.countShares(page), 2);
+  buddy.free(page);
+  buddy.free(page);
+  EXPECT_EQ(buddy.freePages(), 1023);
+  buddy.free(page);
+  EXPECT_EQ(buddy.freePages(), 1024);
+  EXPECT_EQ(buddy.alloc(1), page);
+  EXPECT_EQ(buddy.countShares(page), 0) << "a reallocated block starts unshared";
+}
+
+TEST_F(BuddyAllocatorTest, IgnoresDoubleFrees) {
+  init(0, 4 * MiB);
+  buddy.addRange(0, 4 * MiB);
+  const auto lower = buddy.alloc(1);
+  const auto upper = buddy.alloc(1);
+  ASSERT_EQ(upper, lower + PAGE_SIZE);
+  const auto block = buddy.alloc(4);
+  buddy.free(block + PAGE_SIZE);
+  EXPECT_EQ(buddy.freePages(), 1024 - 6) << "not the head of the block";
+  buddy.free(lower);
+  buddy.free(upper);
+  buddy.free(block);
+  EXPECT_EQ(buddy.freePages(), 1024);
+  const auto blocks = buddy.countFreeBlocks(memory::BuddyAllocator::ORDER_2M);
+  buddy.free(upper);
+  buddy.free(lower);
+  buddy.free(block);
+  buddy.free(block + PAGE_SIZE);
+  EXPECT_EQ(buddy.freePages(), 1024);
+  EXPECT_EQ(buddy.countFreeBlocks(0), 0);
+  EXPECT_EQ(buddy.countFreeBlocks(memory::BuddyAllocator::ORDER_2M), blocks);
+  EXPECT_FALSE(buddy.share(upper)) << "merged into its lower buddy";
+  EXPECT_EQ(buddy.countShares(upper), 0);
+}
@@ -0,0 +1,54 @@
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <memory>
+#include "PageTable.h"
+#include "SimulatedMemory.h"
+#include "arch/x86_64/memory/PageTableArch.h"
+
+void *getPage(const size_t) { return nullptr; }
+
+void freePage(void *) {}
+
+void halt() { abort(); }
+
+void panic(const char *, uint32_t, const char *) { abort(); }
+
+void panicf(const char *, uint32_t, const char *, ...) { abort(); }
+
+namespace {
+  using Arch = memory::x86_64::PageTableArch;
+
+  constexpr uint64_t PAGE_SIZE_2M = 1ull << 21;
+  constexpr uint64_t PAGE_SIZE_1G = 1ull << 30;
+  constexpr uint64_t BASE = 1ull << 40;
+
+  // Maps state.range(0) GiB in one mapMemory call. The physical start decides the page size: mapMemory uses the
+  // largest page both addresses are aligned to, so an offset of 4 KiB keeps it at 4 KiB pages and an offset of
+  // 2 MiB at 2 MiB pages.
+  void mapGigabytes(benchmark::State &state, const uint64_t physicalStart) {
+    const auto size = static_cast<uint64_t>(state.range(0)) * PAGE_SIZE_1G;
+    uint64_t tables = 0;
+    for (auto _: state) {
+      state.PauseTiming();
+      // unmapping the touched tables is not part of the measurement
+      auto memory = std::make_unique<SimulatedMemory>();
+      SimulatedPageTable<Arch> paging(*memory);
+      const auto before = memory->countTables();
+      state.ResumeTiming();
+      paging.mapMemory(physicalStart, BASE, PAGE_SIZE, size / PAGE_SIZE, Arch::PAGE_WRITE);
+      state.PauseTiming();
+      tables = memory->countTables() - before;
+      memory.reset();
+      state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * (size / PAGE_SIZE)));
+    state.counters["tables"] = static_cast<double>(tables);
+    state.counters["table_bytes"] = static_cast<double>(tables * PAGE_SIZE);
+  }
+
+  void BM_Map4KPages(benchmark::State &state) { mapGigabytes(state, PAGE_SIZE); }
+  void BM_Map2MPages(benchmark::State &state) { mapGigabytes(state, PAGE_SIZE_2M); }
+} // namespace
+
+BENCHMARK(BM_Map4KPages)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Map2MPages)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond);
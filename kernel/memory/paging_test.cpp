@@ -0,0 +1,537 @@
+#include <cstdarg>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "AsidAllocator.h"
+#include "BuddyAllocator.h"
+#include "MapTrace.h"
+#include "PageTable.h"
+#include "SimulatedMemory.h"
+#include "TlbBatch.h"
+#include "arch/aarch64/memory/PageTableArch.h"
+#include "arch/x86_64/memory/PageTableArch.h"
+
+void *getPage(const size_t) { return nullptr; }
+
+void freePage(void *) {}
+
+void halt() { abort(); }
+
+void panic(const char *file, const uint32_t line, const char *msg) {
+  throw std::runtime_error(std::string(file) + ":" + std::to_string(line) + " " + msg);
+}
+
+void panicf(const char *file, const uint32_t line, const char *fmt, ...) {
+  char msg[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+  panic(file, line, msg);
+}
+
+namespace {
+  constexpr uint64_t PAGE_SIZE_2M = 1ull << 21;
+  constexpr uint64_t PAGE_SIZE_1G = 1ull << 30;
+  // well away from the hhdm of the simulated memory
+  constexpr uint64_t BASE = 1ull << 40;
+} // namespace
+
+template<typename Arch>
+class PagingTest : public testing::Test {
+protected:
+  SimulatedMemory memory;
+  SimulatedPageTable<Arch> paging{memory};
+  // writable where the encoding has a bit for it
+  const uint64_t flags = Arch::withWrite(0, true);
+  const uint64_t userFlags = Arch::globalFlags(flags, false);
+
+  void expectLeaf(const typename SimulatedPageTable<Arch>::Leaf &leaf, const uint64_t virtualAddress,
+                  const uint64_t physicalAddress, const uint64_t pageSize) {
+    EXPECT_EQ(leaf.virtualAddress, virtualAddress);
+    EXPECT_EQ(leaf.physicalAddress, physicalAddress);
+    EXPECT_EQ(leaf.pageSize, pageSize);
+    EXPECT_EQ(leaf.flags, userFlags);
+  }
+};
+
+using Architectures = testing::Types<memory::x86_64::PageTableArch, memory::aarch64::PageTableArch>;
+TYPED_TEST_SUITE(PagingTest, Architectures);
+
+TYPED_TEST(PagingTest, MapsSmallPages) {
+  this->paging.mapMemory(0x5000, BASE + 0x1000, PAGE_SIZE, 3, this->flags);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G);
+  ASSERT_EQ(leaves.size(), 3);
+  for (size_t i = 0; i < leaves.size(); i++) {
+    this->expectLeaf(leaves[i], BASE + 0x1000 + i * PAGE_SIZE, 0x5000 + i * PAGE_SIZE, PAGE_SIZE);
+  }
+  int level;
+  EXPECT_NE(*this->paging.lookup(BASE + 0x2000, level) & TypeParam::PRESENT, 0);
+  EXPECT_EQ(level, 4);
+  EXPECT_EQ(*this->paging.lookup(BASE + 0x4000, level) & TypeParam::PRESENT, 0);
+}
+
+TYPED_TEST(PagingTest, UsesTheLargestPageAlignmentAllows) {
+  // 4 KiB up to the first 2 MiB boundary, one 2 MiB page and 4 KiB for the rest
+  const auto start = PAGE_SIZE_2M - PAGE_SIZE;
+  this->paging.mapMemory(start, BASE + start, PAGE_SIZE, 2 + PAGE_SIZE_2M / PAGE_SIZE, this->flags);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G);
+  ASSERT_EQ(leaves.size(), 3);
+  this->expectLeaf(leaves[0], BASE + start, start, PAGE_SIZE);
+  this->expectLeaf(leaves[1], BASE + PAGE_SIZE_2M, PAGE_SIZE_2M, PAGE_SIZE_2M);
+  this->expectLeaf(leaves[2], BASE + PAGE_SIZE_2M * 2, PAGE_SIZE_2M * 2, PAGE_SIZE);
+}
+
+TYPED_TEST(PagingTest, MisalignedPhysicalAddressKeepsSmallPages) {
+  this->paging.mapMemory(PAGE_SIZE_2M + PAGE_SIZE, BASE + PAGE_SIZE_2M, PAGE_SIZE, PAGE_SIZE_2M / PAGE_SIZE,
+                         this->flags);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G);
+  ASSERT_EQ(leaves.size(), PAGE_SIZE_2M / PAGE_SIZE);
+  EXPECT_EQ(leaves.back().physicalAddress, PAGE_SIZE_2M * 2);
+}
+
+TYPED_TEST(PagingTest, GigaPagesNeedOnlyOneTable) {
+  const auto before = this->memory.countTables();
+  this->paging.mapMemory(PAGE_SIZE_1G, BASE + PAGE_SIZE_1G, PAGE_SIZE, PAGE_SIZE_1G / PAGE_SIZE, this->flags);
+  EXPECT_EQ(this->memory.countTables() - before, 1);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G * 2);
+  ASSERT_EQ(leaves.size(), 1);
+  this->expectLeaf(leaves[0], BASE + PAGE_SIZE_1G, PAGE_SIZE_1G, PAGE_SIZE_1G);
+}
+
+TYPED_TEST(PagingTest, SmallPagesCountTheirTables) {
+  const auto before = this->memory.countTables();
+  this->paging.mapMemory(PAGE_SIZE, BASE, PAGE_SIZE, PAGE_SIZE_1G / PAGE_SIZE, this->flags);
+  // one table each for the 1 GiB and 2 MiB levels and 512 with the 4 KiB entries
+  EXPECT_EQ(this->memory.countTables() - before, 2 + 512);
+  EXPECT_EQ(this->paging.leaves(BASE, BASE + PAGE_SIZE_1G).size(), PAGE_SIZE_1G / PAGE_SIZE);
+}
+
+TYPED_TEST(PagingTest, MapPartialCoversTheWholeRange) {
+  this->paging.mapPartial(0x10800, BASE + 0x20800, 0x1000, this->flags);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G);
+  ASSERT_EQ(leaves.size(), 2);
+  this->expectLeaf(leaves[0], BASE + 0x20000, 0x10000, PAGE_SIZE);
+  this->expectLeaf(leaves[1], BASE + 0x21000, 0x11000, PAGE_SIZE);
+}
+
+TYPED_TEST(PagingTest, UnmapRemovesPages) {
+  this->paging.mapMemory(0x5000, BASE + 0x1000, PAGE_SIZE, 4, this->flags);
+  const auto invalidations = this->paging.tlbBatch().countPageInvalidations();
+  this->paging.unmapMemory(BASE + 0x2000, 2, PAGE_SIZE);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G);
+  ASSERT_EQ(leaves.size(), 2);
+  this->expectLeaf(leaves[0], BASE + 0x1000, 0x5000, PAGE_SIZE);
+  this->expectLeaf(leaves[1], BASE + 0x4000, 0x8000, PAGE_SIZE);
+  EXPECT_EQ(this->paging.tlbBatch().countPageInvalidations() - invalidations, 2);
+}
+
+TYPED_TEST(PagingTest, UnmapOnlyRemovesHugePagesAsAWhole) {
+  this->paging.mapMemory(PAGE_SIZE_2M, BASE + PAGE_SIZE_2M, PAGE_SIZE_2M, 1, this->flags);
+  this->paging.unmapMemory(BASE + PAGE_SIZE_2M + PAGE_SIZE, 1, PAGE_SIZE);
+  EXPECT_EQ(this->paging.leaves(BASE, BASE + PAGE_SIZE_1G).size(), 1);
+  this->paging.unmapMemory(BASE + PAGE_SIZE_2M, 1, PAGE_SIZE_2M);
+  EXPECT_TRUE(this->paging.leaves(BASE, BASE + PAGE_SIZE_1G).empty());
+}
+
+TYPED_TEST(PagingTest, UnmapOfUnmappedMemoryIsIgnored) {
+  this->paging.unmapMemory(BASE, 16, PAGE_SIZE);
+  EXPECT_TRUE(this->paging.leaves(BASE, BASE + PAGE_SIZE_1G).empty());
+}
+
+TYPED_TEST(PagingTest, UnmapReclaimsEmptyTables) {
+  const auto before = this->memory.countTables();
+  this->paging.mapMemory(0x5000, BASE + PAGE_SIZE_2M - 2 * PAGE_SIZE, PAGE_SIZE, 4, this->flags);
+  // the range crosses into a second 4 KiB table
+  EXPECT_EQ(this->memory.countTables() - before, 4);
+  this->paging.unmapMemory(BASE + PAGE_SIZE_2M - 2 * PAGE_SIZE, 2, PAGE_SIZE);
+  EXPECT_EQ(this->paging.countReclaimedTables(), 1);
+  this->paging.unmapMemory(BASE + PAGE_SIZE_2M, 2, PAGE_SIZE);
+  EXPECT_EQ(this->paging.countReclaimedTables(), 4);
+  EXPECT_EQ(this->memory.countTables(), before);
+  this->paging.mapMemory(0x5000, BASE, PAGE_SIZE, 1, this->flags);
+  EXPECT_EQ(this->paging.leaves(BASE, BASE + PAGE_SIZE_1G).size(), 1);
+}
+
+TYPED_TEST(PagingTest, ReclaimedTablesAreFreedAfterTheBatch) {
+  this->paging.mapMemory(0x5000, BASE, PAGE_SIZE, 1, this->flags);
+  const auto tables = this->memory.countTables();
+  this->paging.beginBatch();
+  this->paging.unmapMemory(BASE, 1, PAGE_SIZE);
+  EXPECT_EQ(this->memory.countTables(), tables);
+  this->paging.endBatch();
+  EXPECT_EQ(this->memory.countTables(), tables - 3);
+}
+
+TYPED_TEST(PagingTest, ReclaimedTablesFlushEveryId) {
+  this->paging.mapMemory(0x5000, BASE, PAGE_SIZE, 1, this->flags);
+  const auto fullFlushes = this->paging.tlbBatch().countFullFlushes();
+  this->paging.unmapMemory(BASE, 1, PAGE_SIZE);
+  // page invalidations reach every id only where they are broadcast
+  EXPECT_EQ(this->paging.tlbBatch().countFullFlushes() - fullFlushes, TypeParam::BROADCAST_INVALIDATION ? 0 : 1);
+}
+
+TYPED_TEST(PagingTest, UnmapInAnInactiveSpaceDropsItsId) {
+  this->paging.acquireAsid();
+  this->paging.mapMemory(0x5000, BASE, PAGE_SIZE, 2, this->flags);
+  this->paging.unmapMemory(BASE, 1, PAGE_SIZE);
+  EXPECT_EQ(this->paging.hasAsid(), TypeParam::BROADCAST_INVALIDATION);
+}
+
+TYPED_TEST(PagingTest, SharedKernelHalfTablesStay) {
+  const auto kernel = this->paging.kernelHalfStart() + PAGE_SIZE_1G;
+  this->paging.mapMemory(0x5000, kernel, PAGE_SIZE, 1, this->flags);
+  this->paging.unmapMemory(kernel, 1, PAGE_SIZE);
+  // with a single root the 1 GiB table is referenced by every address space, a kernel root is shared as a whole
+  EXPECT_EQ(this->paging.countReclaimedTables(), TypeParam::ROOTS == 1 ? 2 : 3);
+}
+
+TYPED_TEST(PagingTest, MappingIntoAHugePageLeavesItAlone) {
+  this->paging.mapMemory(PAGE_SIZE_2M, BASE + PAGE_SIZE_2M, PAGE_SIZE_2M, 1, this->flags);
+  this->paging.mapMemory(0x5000, BASE + PAGE_SIZE_2M + PAGE_SIZE, PAGE_SIZE, 1, this->flags);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G);
+  ASSERT_EQ(leaves.size(), 1);
+  EXPECT_EQ(leaves[0].pageSize, PAGE_SIZE_2M);
+}
+
+TYPED_TEST(PagingTest, RemappingTheSamePageIsAllowed) {
+  this->paging.mapMemory(0x5000, BASE, PAGE_SIZE, 1, this->flags);
+  EXPECT_NO_THROW(this->paging.mapMemory(0x5000, BASE, PAGE_SIZE, 1, this->flags));
+  EXPECT_THROW(this->paging.mapMemory(0x6000, BASE, PAGE_SIZE, 1, this->flags), std::runtime_error);
+}
+
+TYPED_TEST(PagingTest, UnalignedAddressesPanic) {
+  EXPECT_THROW(this->paging.mapMemory(0x5001, BASE, PAGE_SIZE, 1, this->flags), std::runtime_error);
+  EXPECT_THROW(this->paging.mapMemory(0x5000, BASE + 1, PAGE_SIZE, 1, this->flags), std::runtime_error);
+}
+
+TYPED_TEST(PagingTest, TablesFaultingForTablesPanic) {
+  static SimulatedPageTable<TypeParam> *space;
+  static uint64_t flags;
+  static uint64_t next;
+  space = &this->paging;
+  flags = this->flags;
+  next = 0;
+  // clearing every new table faults on a page whose mapping needs a new table of its own
+  SimulatedPageTable<TypeParam>::setTableAllocator(
+      [](const size_t count) {
+        space->mapMemory(0x5000, BASE + ++next * PAGE_SIZE_1G * 512, PAGE_SIZE, 1, flags);
+        return SimulatedMemory::allocTable(count);
+      },
+      SimulatedMemory::freeTable);
+  EXPECT_THROW(this->paging.mapMemory(0x5000, BASE, PAGE_SIZE, 1, this->flags), std::runtime_error);
+  SimulatedPageTable<TypeParam>::setTableAllocator(SimulatedMemory::allocTable, SimulatedMemory::freeTable);
+}
+
+TYPED_TEST(PagingTest, KernelHalfIsGlobal) {
+  const auto kernel = this->paging.kernelHalfStart() + PAGE_SIZE_1G;
+  this->paging.mapMemory(0x5000, kernel, PAGE_SIZE, 1, this->flags);
+  const auto leaves = this->paging.leaves(kernel, kernel + PAGE_SIZE);
+  ASSERT_EQ(leaves.size(), 1);
+  EXPECT_EQ(leaves[0].virtualAddress, kernel);
+  EXPECT_EQ(leaves[0].flags, TypeParam::globalFlags(this->flags, true));
+}
+
+TYPED_TEST(PagingTest, NewTablesAreReachableThroughTheHhdm) {
+  this->paging.mapMemory(PAGE_SIZE, BASE, PAGE_SIZE, 4, this->flags);
+  // the hhdm of the simulated memory is a single 1 GiB page mapping every table
+  const auto hhdm = this->memory.hhdmOffset();
+  const auto leaves = this->paging.leaves(hhdm, hhdm + SimulatedMemory::SIZE);
+  ASSERT_EQ(leaves.size(), 1);
+  EXPECT_EQ(leaves[0].physicalAddress, 0);
+  EXPECT_EQ(leaves[0].pageSize, PAGE_SIZE_1G);
+}
+
+TYPED_TEST(PagingTest, MemoryTypeReplacesCacheBits) {
+  const auto flags = this->flags | TypeParam::memoryTypeFlags(memory::MemoryType::UC);
+  this->paging.mapMemory(PAGE_SIZE, BASE, PAGE_SIZE, 1, flags, memory::MemoryType::WC);
+  this->paging.mapMemory(PAGE_SIZE_2M, BASE + PAGE_SIZE_2M, PAGE_SIZE, 512, flags, memory::MemoryType::WC);
+  const auto leaves = this->paging.leaves(BASE, BASE + PAGE_SIZE_1G);
+  ASSERT_EQ(leaves.size(), 2);
+  const auto expected = TypeParam::globalFlags(this->flags | TypeParam::memoryTypeFlags(memory::MemoryType::WC), false);
+  EXPECT_EQ(leaves[0].pageSize, PAGE_SIZE);
+  EXPECT_EQ(leaves[0].flags, expected);
+  EXPECT_EQ(leaves[1].pageSize, PAGE_SIZE_2M);
+  EXPECT_EQ(leaves[1].flags, expected);
+}
+
+TEST(PageTableArchTest, X86SoftwareBitsStayClearOfRawFlags) {
+  using Arch = memory::x86_64::PageTableArch;
+  // smbios maps with 0x700, which must not read as copy on write or owned
+  EXPECT_EQ((Arch::COW | Arch::OWNED) & 0xFFF, 0);
+  EXPECT_EQ(Arch::leafFlags(Arch::makeLeaf(0x5000, Arch::COW | Arch::OWNED, 4), 4), Arch::COW | Arch::OWNED);
+}
+
+TEST(PageTableArchTest, Aarch64FlagsMoveToTheKernelMairLayout) {
+  using Arch = memory::aarch64::PageTableArch;
+  // normal write back, Device-GRE, Device-nGnRnE, Device-nGnRE, normal non cacheable and normal write through
+  constexpr uint64_t limineMair = 0xFFull | 0x0Cull << 8 | 0x00ull << 16 | 0x04ull << 24 | 0x44ull << 32 |
+                                  0xBBull << 40;
+  const auto attribute = [](const uint64_t index) { return index << Arch::PAGE_ATTR_INDEX_SHIFT; };
+  EXPECT_EQ(Arch::relayoutFlags(attribute(0) | 0x700, limineMair),
+            Arch::memoryTypeFlags(memory::MemoryType::WB) | 0x700);
+  EXPECT_EQ(Arch::relayoutFlags(attribute(1), limineMair), Arch::memoryTypeFlags(memory::MemoryType::UC));
+  EXPECT_EQ(Arch::relayoutFlags(attribute(3), limineMair), Arch::memoryTypeFlags(memory::MemoryType::UC));
+  EXPECT_EQ(Arch::relayoutFlags(attribute(4), limineMair), Arch::memoryTypeFlags(memory::MemoryType::WC));
+  EXPECT_EQ(Arch::relayoutFlags(attribute(5) | Arch::PAGE_READ_ONLY, limineMair),
+            Arch::memoryTypeFlags(memory::MemoryType::WT) | Arch::PAGE_READ_ONLY);
+  // the kernel's own layout maps onto itself
+  for (const auto type: {memory::MemoryType::WB, memory::MemoryType::WC, memory::MemoryType::UC,
+                         memory::MemoryType::WT}) {
+    EXPECT_EQ(Arch::relayoutFlags(Arch::memoryTypeFlags(type), Arch::MAIR_LAYOUT), Arch::memoryTypeFlags(type));
+  }
+}
+
+TEST(PageTableArchTest, X86PatBitMovesForSmallPages) {
+  using Arch = memory::x86_64::PageTableArch;
+  const auto wc = Arch::memoryTypeFlags(memory::MemoryType::WC);
+  EXPECT_EQ(Arch::makeLeaf(0x5000, wc, 4), 0x5000 | Arch::PAGE_PRESENT | Arch::PAGE_PAT_4K | Arch::PAGE_WRITE_THROUGH);
+  EXPECT_EQ(Arch::makeLeaf(0x200000, wc, 3) & Arch::PAGE_PAT, Arch::PAGE_PAT);
+  EXPECT_EQ(Arch::leafFlags(Arch::makeLeaf(0x5000, wc, 4), 4), wc);
+  EXPECT_EQ(Arch::leafFlags(Arch::makeLeaf(0x200000, wc, 3), 3), wc);
+}
+
+// address spaces with owned pages, whose frames come from the upper half of the simulated memory
+template<typename Arch>
+class AddressSpaceTest : public PagingTest<Arch> {
+protected:
+  static constexpr uint64_t FRAMES = SimulatedMemory::SIZE / 2;
+  static constexpr uint64_t PATTERN = 0x0123456789ABCDEF;
+  std::vector<uint8_t> metadata;
+  SimulatedPageTable<Arch> parent;
+  SimulatedPageTable<Arch> child;
+  uint64_t frame = 0;
+
+  void SetUp() override {
+    metadata.resize(memory::BuddyAllocator::metadataSize(FRAMES, SimulatedMemory::SIZE));
+    memory::frameAllocator.init(FRAMES, SimulatedMemory::SIZE, metadata.data(), this->memory.hhdmOffset());
+    memory::frameAllocator.addRange(FRAMES, SimulatedMemory::SIZE - FRAMES);
+    parent.createFrom(this->paging);
+    frame = memory::frameAllocator.alloc(1);
+    *static_cast<uint64_t *>(memory::frameAllocator.toVirtual(frame)) = PATTERN;
+    parent.mapMemory(frame, BASE, PAGE_SIZE, 1, this->userFlags | Arch::OWNED);
+  }
+
+  [[nodiscard]] typename SimulatedPageTable<Arch>::Leaf leafOf(const SimulatedPageTable<Arch> &space) const {
+    const auto leaves = space.leaves(BASE, BASE + PAGE_SIZE);
+    EXPECT_EQ(leaves.size(), 1);
+    return leaves.empty() ? typename SimulatedPageTable<Arch>::Leaf{} : leaves[0];
+  }
+
+  [[nodiscard]] static uint64_t contentOf(const uint64_t physical) {
+    return *static_cast<uint64_t *>(memory::frameAllocator.toVirtual(physical));
+  }
+};
+
+TYPED_TEST_SUITE(AddressSpaceTest, Architectures);
+
+TYPED_TEST(AddressSpaceTest, ForkSharesOwnedPagesCopyOnWrite) {
+  this->child.forkFrom(this->parent);
+  for (const auto space: {&this->parent, &this->child}) {
+    const auto leaf = this->leafOf(*space);
+    EXPECT_EQ(leaf.physicalAddress, this->frame);
+    EXPECT_FALSE(TypeParam::isWritable(leaf.flags));
+    EXPECT_TRUE(leaf.flags & TypeParam::COW);
+  }
+  EXPECT_EQ(memory::frameAllocator.countShares(this->frame), 1);
+}
+
+TYPED_TEST(AddressSpaceTest, FirstWriteCopiesASharedPage) {
+  this->child.forkFrom(this->parent);
+  EXPECT_TRUE(this->child.handleWriteFault(BASE));
+  const auto leaf = this->leafOf(this->child);
+  EXPECT_NE(leaf.physicalAddress, this->frame);
+  EXPECT_TRUE(TypeParam::isWritable(leaf.flags));
+  EXPECT_FALSE(leaf.flags & TypeParam::COW);
+  EXPECT_EQ(this->contentOf(leaf.physicalAddress), this->PATTERN);
+  // the parent still holds the original until it writes itself
+  EXPECT_TRUE(this->leafOf(this->parent).flags & TypeParam::COW);
+  EXPECT_EQ(memory::frameAllocator.countShares(this->frame), 0);
+  EXPECT_FALSE(this->child.handleWriteFault(BASE));
+}
+
+TYPED_TEST(AddressSpaceTest, LastHolderGetsWriteAccessBack) {
+  this->child.forkFrom(this->parent);
+  EXPECT_TRUE(this->child.handleWriteFault(BASE));
+  const auto freePages = memory::frameAllocator.freePages();
+  EXPECT_TRUE(this->parent.handleWriteFault(BASE));
+  const auto leaf = this->leafOf(this->parent);
+  EXPECT_EQ(leaf.physicalAddress, this->frame);
+  EXPECT_TRUE(TypeParam::isWritable(leaf.flags));
+  EXPECT_FALSE(leaf.flags & TypeParam::COW);
+  EXPECT_EQ(memory::frameAllocator.freePages(), freePages);
+}
+
+TYPED_TEST(AddressSpaceTest, DestroyFreesTablesAndFrames) {
+  const auto tables = this->memory.countTables();
+  const auto freePages = memory::frameAllocator.freePages();
+  this->child.forkFrom(this->parent);
+  EXPECT_TRUE(this->child.handleWriteFault(BASE));
+  EXPECT_GT(this->memory.countTables(), tables);
+  this->child.destroy();
+  EXPECT_EQ(this->memory.countTables(), tables);
+  EXPECT_EQ(memory::frameAllocator.freePages(), freePages);
+  // dropping the parent's reference as well leaves nothing allocated
+  this->parent.destroy();
+  EXPECT_EQ(memory::frameAllocator.freePages(), memory::frameAllocator.totalPages());
+}
+
+TYPED_TEST(AddressSpaceTest, NewKernelHalfRootEntriesReachExistingSpaces) {
+  // a root entry of the kernel half nothing has used yet
+  const auto kernel = this->paging.kernelHalfStart() + 3 * PAGE_SIZE_1G * 512;
+  this->paging.mapMemory(0x5000, kernel, PAGE_SIZE, 1, this->flags);
+  for (const auto space: {&this->parent, &this->child}) {
+    if (space == &this->child) {
+      this->child.createFrom(this->paging);
+    }
+    int level;
+    const auto entry = space->lookup(kernel, level);
+    EXPECT_TRUE(*entry & TypeParam::PRESENT);
+    EXPECT_EQ(level, 4);
+  }
+}
+
+class TlbBatchTest : public testing::Test {
+protected:
+  static std::vector<uint64_t> invalidated;
+  static int fullFlushes;
+  memory::TlbBatch tlb{[](const uint64_t address) { invalidated.push_back(address); }, [] { fullFlushes++; }};
+
+  void SetUp() override {
+    invalidated.clear();
+    fullFlushes = 0;
+  }
+};
+
+std::vector<uint64_t> TlbBatchTest::invalidated;
+int TlbBatchTest::fullFlushes;
+
+TEST_F(TlbBatchTest, FlushesImmediatelyOutsideBatch) {
+  tlb.add(0x1234, 1);
+  EXPECT_EQ(invalidated, std::vector<uint64_t>{0x1000});
+  EXPECT_EQ(tlb.countFlushes(), 1);
+  EXPECT_EQ(tlb.countRanges(), 0);
+}
+
+TEST_F(TlbBatchTest, MergesNeighbouringPages) {
+  tlb.begin();
+  for (uint64_t i = 0; i < 4; i++) {
+    tlb.add(0x10000 + i * PAGE_SIZE, PAGE_SIZE);
+  }
+  tlb.add(0x40000, PAGE_SIZE);
+  EXPECT_EQ(tlb.countRanges(), 2);
+  EXPECT_EQ(tlb.range(0).start, 0x10000);
+  EXPECT_EQ(tlb.range(0).end, 0x14000);
+  EXPECT_TRUE(invalidated.empty()) << "nothing is flushed before the batch ends";
+  tlb.end();
+  EXPECT_EQ(invalidated.size(), 5);
+  EXPECT_EQ(tlb.countFlushes(), 1);
+  EXPECT_EQ(tlb.countPageInvalidations(), 5);
+  EXPECT_EQ(fullFlushes, 0);
+}
+
+TEST_F(TlbBatchTest, JoinsRangesAPageBridges) {
+  tlb.begin();
+  tlb.add(0x10000, PAGE_SIZE);
+  tlb.add(0x12000, PAGE_SIZE);
+  tlb.add(0x14000, PAGE_SIZE);
+  EXPECT_EQ(tlb.countRanges(), 3);
+  tlb.add(0x11000, PAGE_SIZE);
+  tlb.add(0x13000, 2 * PAGE_SIZE);
+  EXPECT_EQ(tlb.countRanges(), 1);
+  EXPECT_EQ(tlb.range(0).start, 0x10000);
+  EXPECT_EQ(tlb.range(0).end, 0x15000);
+  tlb.end();
+  EXPECT_EQ(invalidated.size(), 5);
+  EXPECT_EQ(tlb.countPageInvalidations(), 5) << "pages shared by merged ranges are counted once";
+}
+
+TEST_F(TlbBatchTest, NestedBatchesFlushOnce) {
+  tlb.begin();
+  tlb.begin();
+  tlb.add(0x10000, PAGE_SIZE);
+  tlb.end();
+  EXPECT_TRUE(invalidated.empty());
+  tlb.end();
+  EXPECT_EQ(invalidated.size(), 1);
+  EXPECT_EQ(tlb.countFlushes(), 1);
+}
+
+TEST_F(TlbBatchTest, FullFlushAboveThreshold) {
+  tlb.begin();
+  tlb.add(0x100000, (memory::TlbBatch::FULL_FLUSH_PAGES + 1) * PAGE_SIZE);
+  EXPECT_TRUE(tlb.isFullFlush());
+  tlb.end();
+  EXPECT_TRUE(invalidated.empty());
+  EXPECT_EQ(fullFlushes, 1);
+
+  tlb.begin();
+  for (uint64_t i = 0; i <= memory::TlbBatch::MAX_RANGES; i++) {
+    tlb.add(i * 0x100000, PAGE_SIZE);
+  }
+  EXPECT_TRUE(tlb.isFullFlush()) << "more scattered ranges than can be tracked";
+  tlb.end();
+  EXPECT_EQ(fullFlushes, 2);
+  EXPECT_EQ(tlb.countFullFlushes(), 2);
+  EXPECT_FALSE(tlb.isFullFlush());
+}
+
+TEST(MapTrace, KeepsMostRecentEntries) {
+  memory::MapTrace trace;
+  for (uint64_t i = 0; i < memory::MapTrace::CAPACITY + 3; i++) {
+    trace.record(memory::MapTrace::Op::MAP, i * PAGE_SIZE, i * PAGE_SIZE, PAGE_SIZE, 0);
+  }
+  EXPECT_EQ(trace.count(), memory::MapTrace::CAPACITY);
+  EXPECT_EQ(trace.countRecorded(), memory::MapTrace::CAPACITY + 3);
+  EXPECT_EQ(trace.at(0).virtualAddress, 3 * PAGE_SIZE) << "the oldest entries were overwritten";
+  EXPECT_EQ(trace.at(trace.count() - 1).virtualAddress, (memory::MapTrace::CAPACITY + 2) * PAGE_SIZE);
+  trace.setEnabled(false);
+  trace.record(memory::MapTrace::Op::UNMAP, 0, 0, PAGE_SIZE, 0);
+  EXPECT_EQ(trace.countRecorded(), memory::MapTrace::CAPACITY + 3);
+}
+
+TEST(MapTrace, Dump) {
+  memory::MapTrace trace;
+  trace.record(memory::MapTrace::Op::HHDM, 0xffff800000200000, 0x200000, 0x200000, 0x3);
+  static std::string out;
+  out.clear();
+  trace.dump([](const char *text, const size_t length) { out.append(text, length); });
+  EXPECT_EQ(out, "trace.0=hhdm ffff800000200000 200000 200000 3\n");
+}
+
+TEST(AsidAllocator, KeepsIdsWithinGeneration) {
+  memory::AsidAllocator asids(4);
+  memory::AsidAllocator::Asid a, b;
+  EXPECT_EQ(asids.acquire(a), memory::AsidAllocator::Result::NEW);
+  EXPECT_EQ(asids.acquire(b), memory::AsidAllocator::Result::NEW);
+  EXPECT_EQ(a.id, 1u);
+  EXPECT_EQ(b.id, 2u);
+  EXPECT_EQ(asids.acquire(a), memory::AsidAllocator::Result::VALID);
+  EXPECT_EQ(a.id, 1u);
+}
+
+TEST(AsidAllocator, RollsOverWhenIdsRunOut) {
+  memory::AsidAllocator asids(3);
+  memory::AsidAllocator::Asid a, b, c;
+  asids.acquire(a);
+  asids.acquire(b);
+  EXPECT_EQ(asids.acquire(c), memory::AsidAllocator::Result::ROLLOVER);
+  EXPECT_EQ(c.id, 1u);
+  EXPECT_EQ(asids.countRollovers(), 1u);
+  // a was handed out in the previous generation, so it gets a new id instead of sharing one with c
+  EXPECT_EQ(asids.acquire(a), memory::AsidAllocator::Result::NEW);
+  EXPECT_EQ(a.id, 2u);
+  EXPECT_EQ(asids.acquire(c), memory::AsidAllocator::Result::VALID);
+}
+
+TEST(AsidAllocator, SingleIdFlushesOnEverySwitch) {
+  memory::AsidAllocator asids;
+  memory::AsidAllocator::Asid a, b;
+  EXPECT_EQ(asids.acquire(a), memory::AsidAllocator::Result::ROLLOVER);
+  EXPECT_EQ(asids.acquire(a), memory::AsidAllocator::Result::VALID);
+  EXPECT_EQ(asids.acquire(b), memory::AsidAllocator::Result::ROLLOVER);
+  EXPECT_EQ(asids.acquire(a), memory::AsidAllocator::Result::ROLLOVER);
+  EXPECT_EQ(a.id, 0u);
+}
@@ -0,0 +1,41 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+class Spinlock {
+public:
+  void lock() {
+    while (__atomic_test_and_set(&locked, __ATOMIC_ACQUIRE)) {
+      while (__atomic_load_n(&locked, __ATOMIC_RELAXED)) {
+        relax();
+      }
+    }
+  }
+
+  [[nodiscard]] bool tryLock() { return !__atomic_test_and_set(&locked, __ATOMIC_ACQUIRE); }
+
+  void unlock() { __atomic_clear(&locked, __ATOMIC_RELEASE); }
+
+private:
+  bool locked = false;
+
+  static void relax() {
+#if defined(__x86_64__)
+    asm volatile("pause");
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+};
+
+class LockGuard {
+public:
+  [[nodiscard]] explicit LockGuard(Spinlock &lock) : lock(lock) { lock.lock(); }
+  ~LockGuard() { lock.unlock(); }
+  LockGuard(const LockGuard &) = delete;
+  LockGuard &operator=(const LockGuard &) = delete;
+
+private:
+  Spinlock &lock;
+};
+
+#endif // SPINLOCK_H